@@ -1,6 +1,6 @@
 // akemi's PrimeDaihinmin Solver (C) 2019 Fixstars Corp.
-// g++ -W -Wall -std=c++17 -O3 -march=native -mavx arukuka.cpp -lgmp -o X -static
-// g++-8 -W -Wall -std=c++17 -O3 -DOPTIMIZE_PARAM -march=native arukuka.cpp -lgmp -o opt_param/X -static -lstdc++fs
+// g++ -W -Wall -std=c++17 -O3 -march=native -mavx arukuka.cpp -lgmp -pthread -o X -static
+// g++ -W -Wall -std=c++17 -O3 -fPIC -shared -DARUKUKA_LIBRARY arukuka.cpp -lgmp -pthread -o libarukuka.so
 
 #include <iostream>
 #include <sstream>
@@ -9,30 +9,69 @@
 #include <vector>
 #include <deque>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <random>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <algorithm>
 #include <streambuf>
 #include <utility>
+#include <tuple>
+#include <memory>
+#include <limits>
+#include <functional>
+#include <type_traits>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include <boost/hana/string.hpp>
 
 #include <gmpxx.h>
 #include "nlohmann/json.hpp"
 
-#ifdef OPTIMIZE_PARAM
-#include <filesystem>
+#ifdef ARUKUKA_LIBRARY
+#include "arukuka.h"
 #endif
 
 constexpr const char* version  = "0.06";
 constexpr const char* revision = "a";
 constexpr const char* ver_date = "20191225";
 
-static double TIME_LIMIT = 10.0;
+constexpr double DEFAULT_TIME_LIMIT = 10.0; //!< init で持ち時間を受け取るまでの持ち時間
+constexpr double TIME_MARGIN = 0.5;      //!< 通信などで使われる分として残しておく秒数
+constexpr double MAX_TURN_TIME_RATIO = 0.25; //!< 1 手番で使ってよい残り時間の割合の上限
 const int NUM_FIRST_CARDS = 5;
 
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * 探索の打ち切り時刻
+ *
+ * 時計を見るのは呼び出し側が数候補ごとに間引いて行う
+ * cancel が立ったら時刻によらず打ち切る (先読みを次のメッセージで止めるのに使う)
+ */
+struct deadline_t
+{
+	clock_type::time_point limit;
+	const std::atomic<bool>* cancel = nullptr;
+
+	bool expired() const
+	{
+		return (cancel && cancel->load(std::memory_order_relaxed)) || clock_type::now() >= limit;
+	}
+};
+
 namespace util
 {
 #if __cplusplus >= 201703L
@@ -75,6 +114,109 @@ static constexpr T* assume_aligned( T* ptr )
 #endif
 }
 
+/**
+ * xoshiro256** (https://prng.di.unimi.it/)
+ *
+ * 種 1 つから SplitMix64 で状態を作り、jump() で 2^128 個先へ飛ぶ
+ * 同じ種で jump の回数 (stream) が違う列は重ならないので、Solver ごとに列を分けても
+ * 種さえ同じなら同じ乱数列を再現できる
+ */
+class Xoshiro256
+{
+public:
+	using result_type = uint64_t;
+
+	explicit Xoshiro256(const uint64_t seed = 0, const unsigned stream = 0)
+	{
+		this->seed(seed, stream);
+	}
+
+	void seed(uint64_t seed, const unsigned stream = 0)
+	{
+		for (auto& x : s)
+		{
+			seed += 0x9e3779b97f4a7c15;
+			x = mix(seed);
+		}
+		for (unsigned i = 0; i < stream; ++i)
+		{
+			jump();
+		}
+	}
+
+	//! seed から index 番目の種を作る (近い index どうしでも無関係な種になる)
+	static uint64_t derive(const uint64_t seed, const uint64_t index)
+	{
+		return mix(seed ^ mix(index + 0x9e3779b97f4a7c15));
+	}
+
+	static constexpr result_type min()
+	{
+		return 0;
+	}
+
+	static constexpr result_type max()
+	{
+		return std::numeric_limits<result_type>::max();
+	}
+
+	result_type operator()()
+	{
+		const uint64_t result = rotl(s[1] * 5, 7) * 9;
+		const uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+
+	//! 2^128 回分進める
+	void jump()
+	{
+		static constexpr uint64_t JUMP[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+		jump(JUMP);
+	}
+
+private:
+	static uint64_t rotl(const uint64_t x, const int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+
+	//! SplitMix64 の出力関数
+	static uint64_t mix(uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		return z ^ (z >> 31);
+	}
+
+	void jump(const uint64_t (&poly)[4])
+	{
+		uint64_t t[4] = {0};
+		for (const uint64_t j : poly)
+		{
+			for (int b = 0; b < 64; ++b)
+			{
+				if (j & (uint64_t(1) << b))
+				{
+					for (int i = 0; i < 4; ++i)
+					{
+						t[i] ^= s[i];
+					}
+				}
+				(*this)();
+			}
+		}
+		std::copy(t, t + 4, s);
+	}
+
+	uint64_t s[4];
+};
+
 #undef NODISCARD_ATTR
 }
 
@@ -167,9 +309,7 @@ void string2digits(const std::string& s, std::vector<int>& v)
 	}
 }
 
-std::random_device seed_gen;
-std::default_random_engine engine(seed_gen());
-std::string make_candidate(std::vector<int> hand, int length)
+std::string make_candidate(std::vector<int> hand, int length, util::Xoshiro256& engine)
 {
 	std::stringstream ss("");
 
@@ -257,7 +397,7 @@ std::string make_Mersenne(std::vector<int> hand, int length)
 }
 
 [[deprecated]]
-std::vector<int> solver(std::vector<int> hand, const mpz_class& number, int length)
+std::vector<int> solver(std::vector<int> hand, const mpz_class& number, int length, util::Xoshiro256& engine)
 {
 	std::vector<int> cards;
 	std::vector<int> ret({});
@@ -286,7 +426,7 @@ std::vector<int> solver(std::vector<int> hand, const mpz_class& number, int leng
 
 	mpz_class candidate;
 	for (int i = 0; i < 10000; i++) {
-		std::string s = make_candidate(hand, length);
+		std::string s = make_candidate(hand, length, engine);
 		if (!s.empty()) {
 			candidate.set_str(s, 10);
 			if (candidate > number && is_prime(candidate.get_mpz_t())) {
@@ -303,12 +443,43 @@ constexpr size_t MAX_ALIGN = alignof(std::max_align_t);
 #define ALIGNED alignas(MAX_ALIGN)
 using card_type = int16_t;
 using hand_type = card_type[10];
-ALIGNED hand_type g_hand;
-int g_num_hand;
 constexpr int MAX_DIGITS = 16;
-ALIGNED char ans_arr[8192];
-static_assert(sizeof(ans_arr) / sizeof(char) > MAX_DIGITS + (MAX_DIGITS - 1) * 2 + 2, "Answer string storage will be lacking");
-const char *ans_ptr = nullptr;
+
+struct penalty_t
+{
+	int cards_num;               //!< カードをたくさんもっていることによるペナルティ
+	int random;                  //!< 乱数要素
+	ALIGNED int weakness[10];    //!< カード事の弱さ
+};
+
+constexpr penalty_t DEFAULT_PENALTY = {52835, 240601, {779533, 508063, 691015, 34354, 809112, 690669, 789183, 28140, 863356, 870089}};
+
+/**
+ * 1 人分の手札と、手を作るときの作業領域
+ *
+ * 手を作る関数はこれを引数で受け取り、プロセスで共有する状態は持たない
+ */
+struct solver_state_t
+{
+	ALIGNED hand_type hand;
+	int num_hand;
+	ALIGNED char ans_arr[8192];
+	const char* ans_ptr;                                //!< 出す手 (nullptr ならパス)
+	util::Xoshiro256 engine;                            //!< この Solver の乱数列 (ほかと重ならない)
+	penalty_t penalty;
+	std::uniform_int_distribution<> dice_dist;
+	int action_rewords[NUM_FIRST_CARDS + 1];
+
+	solver_state_t(const uint64_t seed, const unsigned stream)
+			: hand{0}
+			, num_hand(0)
+			, ans_ptr(nullptr)
+			, engine(seed, stream)
+			, penalty(DEFAULT_PENALTY)
+			, dice_dist(0, DEFAULT_PENALTY.random + 1)
+			, action_rewords{0} {}
+};
+static_assert(sizeof(solver_state_t::ans_arr) / sizeof(char) > MAX_DIGITS + (MAX_DIGITS - 1) * 2 + 2, "Answer string storage will be lacking");
 
 namespace belphegor
 {
@@ -332,22 +503,23 @@ static constexpr auto generate_belphegor_str()
 			+ boost::hana::string_c<']'>;
 }
 constexpr auto BELPHEGOR_PRIME_CSTR = generate_belphegor_str().c_str();
+constexpr const char* BELPHEGOR_PRIME_STR = "1000000000000066600000000000001";
 }
-static bool belphe_check()
+static bool belphe_check(const solver_state_t& state)
 {
-	return g_hand[0] >= 26
-	    && g_hand[1] >= 2
-			&& g_hand[6] >= 3;
+	return state.hand[0] >= 26
+	    && state.hand[1] >= 2
+			&& state.hand[6] >= 3;
 }
-static void preserve_belphe()
+static void preserve_belphe(solver_state_t& state)
 {
-	g_hand[0] -= 26;
-	g_hand[1] -= 2;
-	g_hand[6] -= 3;
-	g_num_hand -= 31;
+	state.hand[0] -= 26;
+	state.hand[1] -= 2;
+	state.hand[6] -= 3;
+	state.num_hand -= 31;
 }
 
-std::vector<int64_t> mersenne_check(int length, int64_t prev = -1, const card_type * const __restrict _hand = g_hand)
+std::vector<int64_t> mersenne_check(int length, int64_t prev, const card_type * const __restrict _hand)
 {
 	const card_type * const __restrict hand = util::assume_aligned<MAX_ALIGN>(_hand);
 
@@ -397,7 +569,7 @@ std::vector<int64_t> mersenne_check(int length, int64_t prev = -1, const card_ty
 	return ret;
 }
 
-static bool is_possible(const card_type * const __restrict _cnt, const card_type * const __restrict _hand = g_hand)
+static bool is_possible(const card_type * const __restrict _cnt, const card_type * const __restrict _hand)
 {
 	const card_type * const __restrict cnt = util::assume_aligned<MAX_ALIGN>(_cnt);
 	const card_type * const __restrict hand = util::assume_aligned<MAX_ALIGN>(_hand);
@@ -411,7 +583,7 @@ static bool is_possible(const card_type * const __restrict _cnt, const card_type
 	return true;
 }
 
-static bool is_possible(int64_t p, const card_type * const __restrict _hand = g_hand)
+static bool is_possible(int64_t p, const card_type * const __restrict _hand)
 {
 	ALIGNED hand_type cnt = {0};
 	while (p > 0)
@@ -423,7 +595,7 @@ static bool is_possible(int64_t p, const card_type * const __restrict _hand = g_
 	return is_possible(cnt, _hand);
 }
 
-static bool is_possible(const std::string& str)
+static bool is_possible(const std::string& str, const card_type * const __restrict hand)
 {
 	ALIGNED hand_type cnt = {0};
 	for (const auto& c : str)
@@ -431,18 +603,19 @@ static bool is_possible(const std::string& str)
 		int d = c - '0';
 		++cnt[d];
 	}
-	return is_possible(cnt);
+	return is_possible(cnt, hand);
 }
 
-static bool is_possible(const mpz_class& p)
+static bool is_possible(const mpz_class& p, const card_type * const __restrict hand)
 {
 	const std::string str = p.get_str(10);
-	return is_possible(str);
+	return is_possible(str, hand);
 }
 
-static void generate_ans(const std::string str)
+static void generate_ans(solver_state_t& state, const std::string str)
 {
 	const size_t n = str.size();
+	char* const ans_arr = state.ans_arr;
 	ans_arr[0] = '[';
 	for (size_t i = 0; i < n; ++i)
 	{
@@ -451,44 +624,94 @@ static void generate_ans(const std::string str)
 	}
 	ans_arr[n * 2] = ']';
 	ans_arr[n * 2 + 1] = '\0';
-	ans_ptr = ans_arr;
+	state.ans_ptr = ans_arr;
 }
 
-static void generate_ans(int64_t p)
+static void generate_ans(solver_state_t& state, int64_t p)
 {
 	if (p <= 0)
 	{
 		return;
 	}
 	const auto str = std::to_string(p);
-	generate_ans(str);
+	generate_ans(state, str);
 }
 
-struct penalty_t
+/**
+ * state.penalty を JSON で上書きする
+ *
+ * {"cards_num": .., "random": .., "weakness": [10 個]} のうち書かれたものだけを変える
+ * text が '{' で始まらなければ、その名前のファイルから読む
+ * 壊れていたら何も変えずに false
+ */
+static bool set_penalty(solver_state_t& state, const std::string& text)
 {
-	int cards_num;               //!< カードをたくさんもっていることによるペナルティ
-	int random;                  //!< 乱数要素
-	ALIGNED int weakness[10];    //!< カード事の弱さ
-};
-
-penalty_t g_penalty = {52835, 240601, {779533, 508063, 691015, 34354, 809112, 690669, 789183, 28140, 863356, 870089}};
-std::uniform_int_distribution<> g_dice_dist;
+	std::string body = text;
+	if (text.empty() || text[0] != '{')
+	{
+		std::ifstream ifs(text);
+		if (!ifs)
+		{
+			return false;
+		}
+		body.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+	}
+	const nlohmann::json obj = nlohmann::json::parse(body, nullptr, false);
+	if (!obj.is_object())
+	{
+		return false;
+	}
 
-static int evaluate(int64_t p)
-{
-	ALIGNED hand_type next;
-	std::memcpy(next, g_hand, sizeof(g_hand));
-	while (p > 0)
+	penalty_t next = state.penalty;
+	const auto get = [&obj](const char* key, int& value) {
+		const auto it = obj.find(key);
+		if (it == obj.end())
+		{
+			return true;
+		}
+		if (!it->is_number_integer())
+		{
+			return false;
+		}
+		value = it->get<int>();
+		return true;
+	};
+	if (!get("cards_num", next.cards_num) || !get("random", next.random) || next.random < 0)
 	{
-		--next[p % 10];
-		p /= 10;
+		return false;
+	}
+	const auto weakness = obj.find("weakness");
+	if (weakness != obj.end())
+	{
+		if (!weakness->is_array() || weakness->size() != 10)
+		{
+			return false;
+		}
+		for (int i = 0; i < 10; ++i)
+		{
+			if (!(*weakness)[i].is_number_integer())
+			{
+				return false;
+			}
+			next.weakness[i] = (*weakness)[i].get<int>();
+		}
 	}
 
+	state.penalty = next;
+	state.dice_dist.param(decltype(state.dice_dist)::param_type(0, next.random + 1));
+	DBG(body);
+	return true;
+}
+
+static int evaluate(const penalty_t& penalty, const card_type * const __restrict _next)
+{
+	const card_type * const __restrict next = util::assume_aligned<MAX_ALIGN>(_next);
+
 	int score = 0;
 
 	for (int i = 0; i < 10; ++i)
 	{
-		score += next[i] * g_penalty.weakness[i];
+		score += next[i] * penalty.weakness[i];
 	}
 
 	int cnt = 0;
@@ -508,11 +731,22 @@ static int evaluate(int64_t p)
 	return score;
 }
 
-int g_action_rewords[NUM_FIRST_CARDS + 1];
+static int evaluate(const solver_state_t& state, int64_t p)
+{
+	ALIGNED hand_type next;
+	std::memcpy(next, state.hand, sizeof(state.hand));
+	while (p > 0)
+	{
+		--next[p % 10];
+		p /= 10;
+	}
+	return evaluate(state.penalty, next);
+}
 
-static void set_action_rewords(const std::vector<std::pair<std::string, card_type>>& hands, const std::string& name)
+static void set_action_rewords(solver_state_t& state, const std::vector<std::pair<std::string, card_type>>& hands, const std::string& name)
 {
-	memset(g_action_rewords, 0, sizeof(g_action_rewords));
+	int* const action_rewords = state.action_rewords;
+	memset(action_rewords, 0, sizeof(state.action_rewords));
 	const size_t n = hands.size();
 	size_t pos_me = 0;
 	for (size_t i = 0; i < n; ++i)
@@ -540,7 +774,7 @@ static void set_action_rewords(const std::vector<std::pair<std::string, card_typ
 				{
 					if (index != pos_me)
 					{
-						g_action_rewords[start] -= 20'000'000;
+						action_rewords[start] -= 20'000'000;
 					}
 					break;
 				}
@@ -558,7 +792,7 @@ static void set_action_rewords(const std::vector<std::pair<std::string, card_typ
 		}
 		if (pos_me == last)
 		{
-			g_action_rewords[start] += 5'000'000;
+			action_rewords[start] += 5'000'000;
 		}
 		auto result = trial;
 		std::sort(result.begin(), result.end(), [](auto a, auto b){ return a.second < b.second; });
@@ -576,13 +810,13 @@ static void set_action_rewords(const std::vector<std::pair<std::string, card_typ
 		}
 		if (places[name] == 0)
 		{
-			g_action_rewords[start] += 10'000'000;
+			action_rewords[start] += 10'000'000;
 		}
 	}
-	g_action_rewords[3] += 2'500'000;
+	action_rewords[3] += 2'500'000;
 }
 
-static int helper0(int p)
+static int helper0(const solver_state_t& state, int p)
 {
 	int digits = 0;
 	while (p > 0)
@@ -590,22 +824,22 @@ static int helper0(int p)
 		++digits;
 		p /= 10;
 	}
-	return g_action_rewords[digits];
+	return state.action_rewords[digits];
 }
 
-static void solver0()
+static void solver0(solver_state_t& state, const deadline_t& deadline)
 {
-	const int n_max = std::min(g_num_hand, NUM_FIRST_CARDS);
+	const int n_max = std::min(state.num_hand, NUM_FIRST_CARDS);
 
 	int64_t ans = -1;
 	int best_score = std::numeric_limits<int>::max();
 
 	for (int n = n_max; n > 0; --n)
 	{
-		const auto mer = mersenne_check(n);
+		const auto mer = mersenne_check(n, -1, state.hand);
 		for (const int64_t& p : mer)
 		{
-			const int score = evaluate(p);
+			const int score = evaluate(state, p);
 			if (best_score > score)
 			{
 				best_score = score;
@@ -621,12 +855,18 @@ static void solver0()
 	}
 	for (int p = d - 1; p > 0; --p)
 	{
-		if (!is_possible(p))
+		// 時間切れならそれまでの最善を返す
+		if ((p & 1023) == 0 && deadline.expired())
+		{
+			DBG("solver0 timeout");
+			break;
+		}
+		if (!is_possible(p, state.hand))
 		{
 			continue;
 		}
 
-		const int score = evaluate(p) - helper0(p);
+		const int score = evaluate(state, p) - helper0(state, p);
 		if (best_score <= score)
 		{
 			continue;
@@ -640,13 +880,13 @@ static void solver0()
 		best_score = score;
 		ans = p;
 	}
-	generate_ans(ans);
+	generate_ans(state, ans);
 }
 
-static void solver1(const int prev, const int length)
+static void solver1(solver_state_t& state, const int prev, const int length, const deadline_t& deadline)
 {
 	if (length != 1) {
-		const auto mer = mersenne_check(length, prev);
+		const auto mer = mersenne_check(length, prev, state.hand);
 		if (mer.size())
 		{
 			int64_t ans = -1;
@@ -654,14 +894,14 @@ static void solver1(const int prev, const int length)
 
 			for (const int64_t& p : mer)
 			{
-				const int score = evaluate(p);
+				const int score = evaluate(state, p);
 				if (best_score > score)
 				{
 					best_score = score;
 					ans = p;
 				}
 			}
-			generate_ans(ans);
+			generate_ans(state, ans);
 			return;
 		}
 	}
@@ -674,11 +914,16 @@ static void solver1(const int prev, const int length)
 	--d;
 	for (int p = d; p > prev; --p)
 	{
-		if (!is_possible(p))
+		if ((p & 1023) == 0 && deadline.expired())
+		{
+			DBG("solver1 timeout");
+			break;
+		}
+		if (!is_possible(p, state.hand))
 		{
 			continue;
 		}
-		const int score = evaluate(p);
+		const int score = evaluate(state, p);
 		if (best_score <= score)
 		{
 			continue;
@@ -690,31 +935,31 @@ static void solver1(const int prev, const int length)
 		best_score = score;
 		ans = p;
 	}
-	generate_ans(ans);
+	generate_ans(state, ans);
 }
 
-static int score_card(int c, const card_type * const __restrict _cnt)
+static int score_card(solver_state_t& state, int c, const card_type * const __restrict _cnt)
 {
 	const card_type * const __restrict cnt = util::assume_aligned<MAX_ALIGN>(_cnt);
-	return cnt[c] * g_penalty.cards_num + g_penalty.weakness[c] + g_dice_dist(engine);
+	return cnt[c] * state.penalty.cards_num + state.penalty.weakness[c] + state.dice_dist(state.engine);
 };
 
-static void solver(const int length)
+static void solver(solver_state_t& state, const int length, const deadline_t& deadline)
 {
-	if (length > std::min(g_num_hand, MAX_DIGITS)) {
+	if (length > std::min(state.num_hand, MAX_DIGITS)) {
 		return;
 	}
-	const auto mer = mersenne_check(length);
+	const auto mer = mersenne_check(length, -1, state.hand);
 	if (length < 8) {
 		if (mer.size())
 		{
-			generate_ans(mer.back());
+			generate_ans(state, mer.back());
 			return;
 		}
 	}
 
 	ALIGNED hand_type cnt;
-	std::memcpy(cnt, g_hand, sizeof(g_hand));
+	std::memcpy(cnt, state.hand, sizeof(state.hand));
 	std::vector<int> atom;
 	for (int i = 0; i < length; ++i)
 	{
@@ -722,7 +967,7 @@ static void solver(const int length)
 		int ans = -1;
 		for (int j = i == 0; j < 10; ++j)
 		{
-			const int s = score_card(j, cnt);
+			const int s = score_card(state, j, cnt);
 			if (max < s)
 			{
 				max = s;
@@ -737,8 +982,8 @@ static void solver(const int length)
 		--cnt[ans];
 		atom.push_back(ans);
 	}
-	std::shuffle(atom.begin(), atom.begin() + length / 2, engine);
-	std::sort(atom.begin() + length / 2, atom.end(), [&pena = g_penalty.weakness](const int x, const int y) {return pena[x] > pena[y];});
+	std::shuffle(atom.begin(), atom.begin() + length / 2, state.engine);
+	std::sort(atom.begin() + length / 2, atom.end(), [&pena = state.penalty.weakness](const int x, const int y) {return pena[x] > pena[y];});
 	if (atom[0] == 0)
 	{
 		for (int i = 1; i < length; ++i)
@@ -770,10 +1015,15 @@ static void solver(const int length)
 		if (d * d > 2 * start) {
 			break;
 		}
-		if (!is_possible(p)) {
+		// 時間切れならそれまでの最善を返す
+		if ((d & 1023) == 1023 && deadline.expired()) {
+			DBG("solver timeout");
+			break;
+		}
+		if (!is_possible(p, state.hand)) {
 			continue;
 		}
-		const int score = evaluate(p);
+		const int score = evaluate(state, p);
 		if (best_score <= score)
 			continue;
 		x.set_str(std::to_string(p), 10);
@@ -784,7 +1034,7 @@ static void solver(const int length)
 		ans = p;
 	}
 
-	generate_ans(ans);
+	generate_ans(state, ans);
 }
 
 static void convert(const std::vector<int>& src, mpz_class& dst)
@@ -810,446 +1060,4464 @@ static void convert(const std::vector<int>& src, mpz_class& dst)
 	}
 }
 
-static std::vector<int> generate(const int length)
+/**
+ * solver_massive で使うカードの組み合わせを決める
+ *
+ * 並べる前に「素数になり得る」組だけを候補にする
+ * - 桁和が 3 の倍数でない
+ * - 末尾に置ける 1, 3, 7, 9 が含まれる
+ * - 先頭に置ける 0 以外の数字が末尾とは別にある
+ * この制約の下で出した後の evaluate が最小になる枚数の組をナップサック風の DP で求める
+ */
+static bool select_massive_cards(const solver_state_t& state, const int length, card_type * const __restrict _use)
 {
-	ALIGNED hand_type cnt;
-	std::memcpy(cnt, g_hand, sizeof(g_hand));
-	std::vector<int> atom;
-	for (int i = 0; i < length; ++i)
+	card_type * const __restrict use = util::assume_aligned<MAX_ALIGN>(_use);
+
+	// state: (枚数, 桁和 mod 3, 末尾候補あり, 0 以外の枚数 (2 で飽和), 3 と 7 以外を使い切ったか)
+	constexpr int NUM_MOD = 3;
+	constexpr int NUM_TAIL = 2;
+	constexpr int NUM_NONZERO = 3;
+	constexpr int NUM_REST = 2;
+	constexpr int NUM_FLAGS = NUM_MOD * NUM_TAIL * NUM_NONZERO * NUM_REST;
+	const auto index = [](int c, int m, int t, int nz, int r) {
+		return (((c * NUM_MOD + m) * NUM_TAIL + t) * NUM_NONZERO + nz) * NUM_REST + r;
+	};
+	constexpr int64_t NONE = std::numeric_limits<int64_t>::min();
+	const size_t num_states = static_cast<size_t>(length + 1) * NUM_FLAGS;
+
+	std::vector<int64_t> dp(num_states, NONE);
+	std::vector<int64_t> ndp(num_states);
+	std::vector<card_type> choice(num_states * 10);
+	std::vector<int> from(num_states * 10);
+
+	dp[index(0, 0, 0, 0, 1)] = 0;
+	for (int d = 0; d < 10; ++d)
 	{
-		const int from = i == 0 || i + 1 >= length ? 1 : 0;
-		const int step = i + 1 < length ? 1 : 2;
-		int max = -1;
-		int ans = -1;
-		for (int j = from; j < 10; j += step)
+		std::fill(ndp.begin(), ndp.end(), NONE);
+		const bool is_tail = d == 1 || d == 3 || d == 7 || d == 9;
+		const bool is_rest = d == 3 || d == 7;
+		for (int c = 0; c <= length; ++c)
+		for (int m = 0; m < NUM_MOD; ++m)
+		for (int t = 0; t < NUM_TAIL; ++t)
+		for (int nz = 0; nz < NUM_NONZERO; ++nz)
+		for (int r = 0; r < NUM_REST; ++r)
 		{
-			if (cnt[j] <= 0)
+			const int cur = index(c, m, t, nz, r);
+			if (dp[cur] == NONE)
 			{
 				continue;
 			}
-			const int s = score_card(j, cnt);
-			if (max < s)
+			const int k_max = std::min<int>(state.hand[d], length - c);
+			for (int k = 0; k <= k_max; ++k)
 			{
-				max = s;
-				ans = j;
+				const int next = index(
+						c + k,
+						(m + d * k) % NUM_MOD,
+						t | (is_tail && k > 0),
+						d == 0 ? nz : std::min(NUM_NONZERO - 1, nz + k),
+						r & (is_rest || k == state.hand[d]));
+				const int64_t value = dp[cur] + static_cast<int64_t>(k) * state.penalty.weakness[d];
+				if (ndp[next] < value)
+				{
+					ndp[next] = value;
+					choice[next * 10 + d] = k;
+					from[next * 10 + d] = cur;
+				}
 			}
 		}
-		if (ans == -1)
-		{
-			DBG("funyy!");
-			return {};
-		}
-		--cnt[ans];
-		atom.push_back(ans);
+		std::swap(dp, ndp);
 	}
-	if (atom[0] == 0)
+
+	int best = -1;
+	int64_t best_value = NONE;
+	for (int m = 1; m < NUM_MOD; ++m)
 	{
-		for (int i = 1; i < length; ++i)
+		for (int r = 0; r < NUM_REST; ++r)
 		{
-			if (atom[i] > 0)
+			const int cur = index(length, m, 1, NUM_NONZERO - 1, r);
+			if (dp[cur] == NONE)
 			{
-				std::swap(atom[0], atom[i]);
-				break;
+				continue;
+			}
+			// evaluate の「3 と 7 だけが残る」ボーナスを加味する
+			const int64_t value = dp[cur] + (r ? 50'000'000 : 0);
+			if (best_value < value)
+			{
+				best_value = value;
+				best = cur;
 			}
 		}
 	}
+	if (best == -1)
+	{
+		return false;
+	}
 
-	return atom;
+	for (int d = 9, cur = best; d >= 0; --d)
+	{
+		use[d] = choice[cur * 10 + d];
+		cur = from[cur * 10 + d];
+	}
+	return true;
 }
 
 /**
  * でかい数用
  */
-static void solver_massive(const int length)
+static void solver_massive(solver_state_t& state, const int length, const deadline_t& deadline)
 {
-	if (length > g_num_hand /*std::min(g_num_hand, 80)*/)
+	if (length > state.num_hand /*std::min(state.num_hand, 80)*/)
 	{
 		return;
 	}
 
-	mpz_class number = 1_mpz;
-	for (int i = 0; i < 1000; ++i)
+	ALIGNED hand_type use = {0};
+	if (!select_massive_cards(state, length, use))
 	{
-		std::vector<int> pa = generate(length);
-		convert(pa, number);
-		if (is_prime(number.get_mpz_t())) {
-			break;
-		}
-	}
-	if (is_prime(number.get_mpz_t())) {
-		const auto str = number.get_str();
-		generate_ans(str);
+		DBG("no prime-capable cards");
+		return;
 	}
-}
 
-std::deque<std::string> g_win_root;
-static void search_win(const bool belphe_possible, const int length, const mpz_class& prev)
-{
-	// すでに確立していたら出せるか確認する
-	if (g_win_root.size())
+	std::vector<int> tails;
+	for (const int d : {1, 3, 7, 9})
 	{
-		const std::string next = g_win_root.front();
-		if (is_possible(next))
+		if (use[d] > 0)
 		{
-			return;
+			tails.push_back(d);
 		}
-		g_win_root.clear();
 	}
+	std::uniform_int_distribution<> randtail(0, tails.size() - 1);
 
-	struct Node
+	std::vector<int> pa(length);
+	mpz_class number;
+	for (int i = 0; i < 1000; ++i)
 	{
-		ALIGNED std::array<card_type, 10> cur_hand;
-		card_type remain;
-		bool belphe_possible;
-		std::shared_ptr<Node> parent;
-		std::string prev_action;
-		Node()
-				: cur_hand()
-				, remain(0)
-				, parent()
-				, prev_action() {}
-		Node(const Node& node)
-				: cur_hand(node.cur_hand)
-				, remain(node.remain)
-				, parent(node.parent)
-				, prev_action(node.prev_action) {}
-
-		std::shared_ptr<Node> next(int64_t p, const std::shared_ptr<Node> parent) const
+		// 素数判定が重いので 16 候補ごとに時計を見て、時間切れならパスする
+		if ((i & 15) == 15 && deadline.expired())
 		{
-			auto next = std::make_shared<Node>(*this);
-			next->prev_action = std::to_string(p);
-			while (p)
-			{
-				const auto d = p % 10;
-				next->cur_hand[d]--;
-				next->remain--;
-				p /= 10;
-			}
-			next->parent = parent;
-			return next;
+			DBG("solver_massive timeout");
+			return;
 		}
-		std::shared_ptr<Node> use_belphe(const std::shared_ptr<Node> parent) const
+		ALIGNED hand_type cnt;
+		std::memcpy(cnt, use, sizeof(use));
+		const int tail = tails[randtail(state.engine)];
+		--cnt[tail];
+		pa.clear();
+		for (int d = 0; d < 10; ++d)
 		{
-			auto next  = std::make_shared<Node>(*this);
-			next->belphe_possible = false;
-			next->prev_action = "1000000000000066600000000000001";
-			next->parent = parent;
-			return next;
+			pa.insert(pa.end(), cnt[d], d);
 		}
-	};
+		std::shuffle(pa.begin(), pa.end(), state.engine);
+		if (pa[0] == 0)
+		{
+			std::swap(pa[0], *std::find_if(pa.begin(), pa.end(), [](int d){ return d > 0; }));
+		}
+		pa.push_back(tail);
+		convert(pa, number);
+		if (is_prime(number.get_mpz_t())) {
+			const auto str = number.get_str();
+			generate_ans(state, str);
+			return;
+		}
+	}
+}
+
+/**
+ * 場に 2 つ以上出ているとき
+ *
+ * 場の数は見ず、手札と桁数だけで手を決める
+ */
+static void solver2(solver_state_t& state, const int length, const deadline_t& deadline)
+{
+	if (length > 12)
+		solver_massive(state, length, deadline);
+	else
+		solver(state, length, deadline);
+}
 
-	struct NodePriority
+#ifndef SEARCH_THREADS
+#define SEARCH_THREADS 0
+#endif
+//! 勝ち確定探索のスレッド数 (0 ならコア数)
+static int g_search_threads = SEARCH_THREADS;
+
+#ifndef BEAM_WIDTH
+#define BEAM_WIDTH 0
+#endif
+//! 勝ち確定探索を beam stack search で行うときのビーム幅 (0 なら並列最良優先探索)、環境変数 BEAM_WIDTH で上書きできる
+static int g_beam_width = BEAM_WIDTH;
+
+#ifndef PONDER
+#define PONDER 1
+#endif
+//! 相手の手番の間に次の手番を先読みする (0 ならしない)、環境変数 PONDER で上書きできる
+static int g_ponder = PONDER;
+
+/**
+ * 合計 N 枚以下の枚数分布に 0 から順に番号を振る (完全ハッシュ)
+ *
+ * 番号の総数は合計 N 以下の 10 個組の数 C(N + 10, 10)
+ */
+template <int N>
+class MultisetRank
+{
+public:
+	MultisetRank()
 	{
-		bool operator()(const std::shared_ptr<Node> lhs, const std::shared_ptr<Node> rhs) const
+		for (int n = 0; n < N + 11; ++n)
 		{
-			if (lhs->remain != rhs->remain)
+			binom[n][0] = 1;
+			for (int k = 1; k <= 10; ++k)
 			{
-				return lhs->remain < rhs->remain;
+				binom[n][k] = n == 0 ? 0 : binom[n - 1][k - 1] + (k <= n - 1 ? binom[n - 1][k] : 0);
 			}
-			return rhs->belphe_possible > lhs->belphe_possible;
 		}
-	};
-
-	std::set<std::pair<bool, std::array<card_type, 10>>> done;
+	}
 
-	std::shared_ptr<Node> initial_state = std::make_shared<Node>();
-	std::memcpy(initial_state->cur_hand.data(), g_hand, sizeof(g_hand));
-	initial_state->remain = 0;
-	for (const auto c : initial_state->cur_hand)
+	uint32_t size() const
 	{
-		initial_state->remain += c;
+		return binom[N + 10][10];
 	}
-	initial_state->belphe_possible = belphe_possible;
-
-	std::multiset<std::shared_ptr<Node>, NodePriority> tree;
-	if (length > 0)
+	uint32_t operator()(const card_type * const hand) const
 	{
-		std::vector<int64_t> mers;
-		if (length <= 10)
-		{
-			mers = mersenne_check(length, prev.get_si());
-		}
-		if (mers.size())
+		uint32_t ret = 0;
+		int budget = N;
+		for (int i = 0; i < 10; ++i)
 		{
-			for (const auto& p : mers)
+			// i より後ろの数字の組み合わせ数: 合計 r 以下の (9 - i) 個組は C(r + 9 - i, 9 - i)
+			const int rest = 9 - i;
+			for (int j = 0; j < hand[i]; ++j)
 			{
-				tree.insert(initial_state->next(p, initial_state));
+				ret += binom[budget - j + rest][rest];
 			}
+			budget -= hand[i];
 		}
-		else if (belphe_possible)
-		{
-			tree.insert(initial_state->use_belphe(initial_state));
-		}
-		else
-		{
-			return;
-		}
-	}
-	else
-	{
-		tree.insert(initial_state);
+		return ret;
 	}
 
-	std::shared_ptr<Node> ans;
-	// 探索
-	for (int iteration = 0; iteration < 1'000; ++iteration)
+private:
+	uint32_t binom[N + 11][11];
+};
+
+/**
+ * 素数を数字の多重集合 (アナグラムの類) ごとにまとめた表
+ *
+ * N 桁以下を区間ごとに篩い、多重集合の番号 -> その数字をちょうど使い切る素数 (昇順) を CSR で持つ
+ * 先頭 0 の並びは素数として数えない
+ * 1 周目で多重集合ごとの個数を数え、2 周目で詰める。build は打ち切り時刻まで進めて、次に呼ばれたら続きから作る
+ */
+namespace prime_table
+{
+constexpr int MAX_CARDS = 5;
+constexpr int ANAGRAM_CARDS = 7;
+constexpr int32_t SEGMENT = 1 << 16;   //!< 1 度に篩う区間の長さ
+
+template <int N>
+class MultisetPrimes
+{
+public:
+	MultisetPrimes()
+		: offsets(rank.size() + 1, 0)
+		, limit(1)
+		, pos(0)
+		, filling(false)
+		, done(false)
 	{
-		if (tree.empty())
+		for (int i = 0; i < N; ++i)
 		{
-			break;
+			limit *= 10;
 		}
-		auto ite = tree.begin();
-		const std::shared_ptr<Node> node = *ite;
-		tree.erase(ite);
-
-		if (node->remain == 0 && node->belphe_possible == false)
+		// 区間の篩に使う sqrt(limit) 以下の素数
+		int32_t root = 1;
+		while (root * root < limit)
 		{
-			ans = node;
-			break;
+			++root;
 		}
+		std::vector<bool> composite(root + 1, false);
+		for (int32_t p = 2; p <= root; ++p)
 		{
-			const auto state = std::make_pair(node->belphe_possible, node->cur_hand);
-			if (done.count(state))
+			if (composite[p])
 			{
 				continue;
 			}
-			done.insert(state);
-		}
-
-		// max cut
-		{
-			constexpr int max_cut_numbers[6] = {
-				-1,
-				7, // NOTICE: it is mersenne
-				97,
-				997,
-				9973,
-				99991
-			};
-			for (int i = 2; i <= 5; ++i)
+			base.push_back(p);
+			for (int32_t q = p * p; q <= root; q += p)
 			{
-				const int p = max_cut_numbers[i];
-				if (is_possible(p, node->cur_hand.data()))
-				{
-					tree.insert(node->next(p, node));
-				}
+				composite[q] = true;
 			}
 		}
-		// mersenne cut
-		for (int i = 1; i <= 5; ++i)
+	}
+
+	/**
+	 * deadline まで表を作り進める。作り終えていれば true
+	 *
+	 * ほかのスレッドが作っている間は待たずに返る
+	 */
+	bool build(const deadline_t& deadline)
+	{
+		if (ready())
 		{
-			for (const auto p : mersenne_check(i, -1, node->cur_hand.data()))
-			{
-				tree.insert(node->next(p, node));
-			}
+			return true;
 		}
-		// belphe cut
-		if (node->belphe_possible)
+		std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+		if (!lock.owns_lock())
 		{
-			tree.insert(node->use_belphe(node));
+			return ready();
 		}
-
-		// 5!
-		if (node->remain <= 5)
+		std::vector<uint8_t> composite;
+		while (!done.load(std::memory_order_relaxed))
 		{
-			if (node->remain == 1)
+			if (deadline.expired())
 			{
-				int p = 0;
-				for (int i = 0; i < 10; ++i)
+				return false;
+			}
+			const int32_t hi = std::min(limit, pos + SEGMENT);
+			sieve(pos, hi, composite);
+			for (int32_t p = pos; p < hi; ++p)
+			{
+				if (composite[p - pos])
 				{
-					if (node->cur_hand[i])
-					{
-						p = i;
-						break;
-					}
+					continue;
 				}
-				if (is_prime(p))
+				if (filling)
 				{
-					tree.insert(node->next(p, node));
+					primes[fill[key(p)]++] = p;
 				}
-			}
+				else
+				{
+					++offsets[key(p) + 1];
+				}
+			}
+			pos = hi;
+			if (pos < limit)
+			{
+				continue;
+			}
+			if (filling)
+			{
+				fill = std::vector<uint32_t>();
+				done.store(true, std::memory_order_release);
+				break;
+			}
+			for (size_t i = 1; i < offsets.size(); ++i)
+			{
+				offsets[i] += offsets[i - 1];
+			}
+			primes.resize(offsets.back());
+			fill.assign(offsets.begin(), offsets.end() - 1);
+			pos = 0;
+			filling = true;
+		}
+		return true;
+	}
+
+	bool ready() const
+	{
+		return done.load(std::memory_order_acquire);
+	}
+
+	//! ready のときだけ呼ぶ。hand は合計 N 枚以下
+	std::pair<const int32_t*, const int32_t*> find(const card_type * const hand) const
+	{
+		const uint32_t k = rank(hand);
+		return std::make_pair(primes.data() + offsets[k], primes.data() + offsets[k + 1]);
+	}
+
+private:
+	//! [lo, hi) の合成数 (と 0, 1) に印を付ける
+	void sieve(const int32_t lo, const int32_t hi, std::vector<uint8_t>& composite) const
+	{
+		composite.assign(hi - lo, 0);
+		for (int32_t x = lo; x < std::min(hi, 2); ++x)
+		{
+			composite[x - lo] = 1;
+		}
+		for (const int32_t p : base)
+		{
+			if (p * p >= hi)
+			{
+				break;
+			}
+			for (int32_t q = std::max(p * p, (lo + p - 1) / p * p); q < hi; q += p)
+			{
+				composite[q - lo] = 1;
+			}
+		}
+	}
+
+	uint32_t key(int32_t p) const
+	{
+		ALIGNED hand_type cnt = {};
+		for (; p > 0; p /= 10)
+		{
+			++cnt[p % 10];
+		}
+		return rank(cnt);
+	}
+
+	MultisetRank<N> rank;
+	std::vector<uint32_t> offsets;
+	std::vector<int32_t> primes;
+	std::vector<int32_t> base;      //!< sqrt(limit) 未満の素数
+	int32_t limit;                  //!< 10^N
+	std::vector<uint32_t> fill;     //!< 2 周目で次に詰める位置
+	int32_t pos;                    //!< 次に篩う区間の先頭
+	bool filling;                   //!< 2 周目か
+	std::atomic<bool> done;
+	std::mutex mutex;
+};
+
+//! 5 桁以下: 探索中の最後の 1 手。初回に作り切る
+static const MultisetPrimes<MAX_CARDS>& multiset_primes()
+{
+	static MultisetPrimes<MAX_CARDS> instance;
+	static const bool built = instance.build(deadline_t{clock_type::time_point::max()});
+	static_cast<void>(built);
+	return instance;
+}
+
+/**
+ * 7 桁以下: 親でないときに場の桁数で出し切る手
+ *
+ * 10^7 まで篩うので 200ms ほどかかる。Solver が init と手番の始めに打ち切り時刻まで作り進め、ready になるまでは使わない
+ */
+static MultisetPrimes<ANAGRAM_CARDS>& anagram_primes()
+{
+	static MultisetPrimes<ANAGRAM_CARDS> instance;
+	return instance;
+}
+
+/**
+ * length 桁で最大の素数
+ *
+ * 親のときに出せば、次の人も同じ桁数なので返されない。親でないときに出すと次の人は倍の桁数になるので返される
+ * 9 桁まで、なければ 0 (呼び出し側で除く)
+ */
+static int32_t max_prime(const int length)
+{
+	static constexpr int32_t table[] = {0, 7, 97, 997, 9973, 99991, 999983, 9999991, 99999989, 999999937};
+	return 0 < length && length <= 9 ? table[length] : 0;
+}
+}
+
+namespace win_search
+{
+constexpr int32_t ACTION_BELPHEGOR = -1;
+constexpr uint32_t NO_PARENT = std::numeric_limits<uint32_t>::max();
+
+/**
+ * 勝ち確定探索のノード
+ *
+ * 親は arena 上の添字、直前の行動は出した数 (ベルフェゴール素数は ACTION_BELPHEGOR) で持つ
+ * depth は根からの手数
+ */
+struct alignas(MAX_ALIGN) Node
+{
+	hand_type hand;
+	card_type remain;
+	uint8_t belphe_possible;
+	uint8_t depth;
+	uint32_t parent;
+	int32_t action;
+};
+static_assert(sizeof(Node) == 32, "Node should be 32 bytes");
+static_assert(std::is_trivially_copyable<Node>::value, "Node should be POD");
+
+/**
+ * 手札の枚数分布とベルフェ予約の有無に対する Zobrist hash
+ */
+class Zobrist
+{
+public:
+	static constexpr int MAX_COUNT = 512;
+
+	Zobrist()
+	{
+		std::mt19937_64 rng(0x5EED2019);
+		for (auto& row : table)
+		{
+			for (auto& x : row)
+			{
+				x = rng();
+			}
+		}
+		belphe = rng();
+	}
+
+	uint64_t hash(const card_type * const hand, const bool belphe_possible) const
+	{
+		uint64_t h = belphe_possible ? belphe : 0;
+		for (int i = 0; i < 10; ++i)
+		{
+			h ^= table[i][clamp(hand[i])];
+		}
+		return h;
+	}
+	//! 数字 d の枚数が from から to に変わったときの差分更新
+	uint64_t update(const uint64_t h, const int d, const int from, const int to) const
+	{
+		return h ^ table[d][clamp(from)] ^ table[d][clamp(to)];
+	}
+	uint64_t toggle_belphe(const uint64_t h) const
+	{
+		return h ^ belphe;
+	}
+
+private:
+	static int clamp(const int count)
+	{
+		return std::min(std::max(count, 0), MAX_COUNT - 1);
+	}
+
+	uint64_t table[10][MAX_COUNT];
+	uint64_t belphe;
+};
+constexpr int Zobrist::MAX_COUNT;
+static const Zobrist zobrist;
+
+/**
+ * 手番ごとに使い回すノード置き場
+ *
+ * clear は先頭に戻すだけなので確保は最初の 1 回だけ
+ * Node を 32 bytes に保つため hash は別の配列で持つ
+ * 書き込むのは持ち主のスレッドだけで、書いたノードは変更しない
+ */
+class NodeArena
+{
+public:
+	explicit NodeArena(const uint32_t capacity)
+			: nodes(new Node[capacity])
+			, hashes(new uint64_t[capacity])
+			, capacity(capacity)
+			, size(0) {}
+
+	void clear()
+	{
+		size = 0;
+	}
+	bool full() const
+	{
+		return size >= capacity;
+	}
+	uint32_t push(const Node& node, const uint64_t hash)
+	{
+		nodes[size] = node;
+		hashes[size] = hash;
+		return size++;
+	}
+	const Node& operator[](const uint32_t index) const
+	{
+		return nodes[index];
+	}
+	uint64_t hash(const uint32_t index) const
+	{
+		return hashes[index];
+	}
+
+private:
+	std::unique_ptr<Node[]> nodes;
+	std::unique_ptr<uint64_t[]> hashes;
+	const uint32_t capacity;
+	uint32_t size;
+};
+
+/**
+ * 展開済み状態の集合
+ *
+ * 全スレッドで共有する lock-free な開番地法の表で、状態は Zobrist hash で見分ける
+ * 反復深化のため、より浅く到達したときは展開し直せるようにする
+ */
+class SharedVisited
+{
+public:
+	static constexpr uint32_t CAPACITY = 1u << 21;
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "Capacity must be a power of two");
+
+	SharedVisited()
+			: keys(new std::atomic<uint64_t>[CAPACITY])
+			, depths(new std::atomic<uint8_t>[CAPACITY])
+			, count(0)
+	{
+		for (uint32_t i = 0; i < CAPACITY; ++i)
+		{
+			keys[i].store(EMPTY, std::memory_order_relaxed);
+			depths[i].store(UNSEEN, std::memory_order_relaxed);
+		}
+	}
+
+	//! 探索の合間 (ほかのスレッドが止まっているとき) に使った番地だけ戻す
+	void clear(std::vector<uint32_t>& used)
+	{
+		for (const auto pos : used)
+		{
+			keys[pos].store(EMPTY, std::memory_order_relaxed);
+			depths[pos].store(UNSEEN, std::memory_order_relaxed);
+		}
+		used.clear();
+		count.store(0, std::memory_order_relaxed);
+	}
+	bool full() const
+	{
+		return count.load(std::memory_order_relaxed) * 2 >= CAPACITY;
+	}
+	uint64_t key(const uint32_t pos) const
+	{
+		return keys[pos].load(std::memory_order_relaxed);
+	}
+	/**
+	 * 新しく追加できたか、前より浅く到達したら true
+	 *
+	 * 新しく埋めた番地は used に積む
+	 * 深さは key を取れてから縮めるだけにする (取り合いに負けたスレッドが勝った方の深さを書き潰さない)
+	 * key が見えて深さがまだ UNSEEN なら、同じ状態に同時に来たものとしてどちらも true になることがある
+	 */
+	bool insert(uint64_t hash, const uint8_t depth, std::vector<uint32_t>& used)
+	{
+		hash = hash == EMPTY ? 1 : hash;
+		for (uint32_t pos = hash & (CAPACITY - 1); ; pos = (pos + 1) & (CAPACITY - 1))
+		{
+			uint64_t key = keys[pos].load(std::memory_order_acquire);
+			if (key == EMPTY)
+			{
+				if (keys[pos].compare_exchange_strong(key, hash, std::memory_order_acq_rel))
+				{
+					used.push_back(pos);
+					count.fetch_add(1, std::memory_order_relaxed);
+					lower_depth(pos, depth);
+					return true;
+				}
+			}
+			if (key == hash)
+			{
+				return lower_depth(pos, depth);
+			}
+		}
+	}
+
+private:
+	static constexpr uint64_t EMPTY = 0;
+	static constexpr uint8_t UNSEEN = std::numeric_limits<uint8_t>::max();
+
+	//! pos の深さを depth まで縮められたら true
+	bool lower_depth(const uint32_t pos, const uint8_t depth)
+	{
+		uint8_t cur = depths[pos].load(std::memory_order_relaxed);
+		while (depth < cur)
+		{
+			if (depths[pos].compare_exchange_weak(cur, depth, std::memory_order_relaxed))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	std::unique_ptr<std::atomic<uint64_t>[]> keys;
+	std::unique_ptr<std::atomic<uint8_t>[]> depths;
+	std::atomic<uint32_t> count;
+};
+constexpr uint32_t SharedVisited::CAPACITY;
+constexpr uint64_t SharedVisited::EMPTY;
+
+/**
+ * 置換表
+ *
+ * 親として手番を持っている状態について以下を覚えておき、ゲーム中は手番をまたいで使い回す
+ * - WIN: 勝ちが確定している (action が次の一手)
+ * - NO_WIN: 部分木を探索し尽くしても勝ちがなかった
+ * - BOUND: 根から bound 手以内では勝てないと分かっている
+ */
+class TranspositionTable
+{
+public:
+	enum Flag : uint8_t
+	{
+		EMPTY = 0,
+		BOUND,
+		NO_WIN,
+		WIN,
+	};
+	struct Entry
+	{
+		uint64_t key;
+		int32_t action;
+		uint16_t bound;
+		uint8_t flag;
+		uint8_t generation;
+	};
+	static_assert(sizeof(Entry) == 16, "Entry should be 16 bytes");
+
+	static constexpr size_t NUM_BUCKETS = 1 << 16;
+	static constexpr size_t BUCKET_SIZE = 4;
+
+	TranspositionTable()
+			: entries(NUM_BUCKETS * BUCKET_SIZE)
+			, generation(0) {}
+
+	void clear()
+	{
+		std::fill(entries.begin(), entries.end(), Entry{0, 0, 0, EMPTY, 0});
+		generation = 0;
+	}
+	//! 手番ごとに進め、古い BOUND から置き換わるようにする
+	void next_generation()
+	{
+		++generation;
+	}
+	const Entry* probe(const uint64_t key) const
+	{
+		const Entry* bucket = &entries[(key & (NUM_BUCKETS - 1)) * BUCKET_SIZE];
+		for (size_t i = 0; i < BUCKET_SIZE; ++i)
+		{
+			if (bucket[i].flag != EMPTY && bucket[i].key == key)
+			{
+				return &bucket[i];
+			}
+		}
+		return nullptr;
+	}
+	void store(const uint64_t key, const Flag flag, const int32_t action = 0, const int bound = 0)
+	{
+		Entry* bucket = &entries[(key & (NUM_BUCKETS - 1)) * BUCKET_SIZE];
+		Entry* victim = bucket;
+		for (size_t i = 0; i < BUCKET_SIZE; ++i)
+		{
+			if (bucket[i].flag != EMPTY && bucket[i].key == key)
+			{
+				if (bucket[i].flag > flag)
+				{
+					return;
+				}
+				victim = &bucket[i];
+				break;
+			}
+			if (priority(bucket[i]) < priority(*victim))
+			{
+				victim = &bucket[i];
+			}
+		}
+		*victim = Entry{key, action, static_cast<uint16_t>(bound), flag, generation};
+	}
+
+private:
+	int priority(const Entry& entry) const
+	{
+		if (entry.flag == EMPTY)
+		{
+			return -1;
+		}
+		// 今の手番のものを優先し、同じ世代なら WIN > NO_WIN > BOUND
+		const int age = static_cast<uint8_t>(generation - entry.generation);
+		return (255 - age) * 4 + entry.flag;
+	}
+
+	std::vector<Entry> entries;
+	uint8_t generation;
+};
+constexpr size_t TranspositionTable::NUM_BUCKETS;
+constexpr size_t TranspositionTable::BUCKET_SIZE;
+
+/**
+ * 親のときに出せるカット (探索順)
+ */
+struct CutAction
+{
+	int32_t number;
+	ALIGNED hand_type cnt;
+};
+static const std::vector<CutAction>& cut_actions()
+{
+	static const std::vector<CutAction> actions = [] {
+		std::vector<CutAction> ret;
+		// max cut, mersenne cut
+		for (const int32_t p : {97, 997, 9973, 99991, 3, 7, 31, 127, 8191})
+		{
+			CutAction action = {p, {0}};
+			for (int32_t x = p; x > 0; x /= 10)
+			{
+				++action.cnt[x % 10];
+			}
+			ret.push_back(action);
+		}
+		return ret;
+	}();
+	return actions;
+}
+
+/**
+ * カットで減らせないカードが最後の 1 手 (5 枚) に収まらなければ勝てない
+ *
+ * カットに現れない数字に加えて、2 は 127 で、8 は 8191 でしか減らせないので
+ * 組になる 1, 7, 9 が足りない分も最後に残る
+ */
+static bool is_dead(const Node& node)
+{
+	static const std::array<bool, 10> cuttable = [] {
+		std::array<bool, 10> ret = {};
+		for (const auto& cut : cut_actions())
+		{
+			for (int i = 0; i < 10; ++i)
+			{
+				ret[i] = ret[i] || cut.cnt[i] > 0;
+			}
+		}
+		return ret;
+	}();
+	int rest = 0;
+	for (int i = 0; i < 10; ++i)
+	{
+		if (!cuttable[i])
+		{
+			rest += node.hand[i];
+		}
+	}
+	const auto& h = node.hand;
+	rest += std::max(0, h[2] - std::min(h[1], h[7]));
+	rest += std::max(0, h[8] - std::min<int>(h[9], h[1] / 2));
+	return rest > NUM_FIRST_CARDS;
+}
+
+/**
+ * 優先度付きキュー
+ *
+ * 残り枚数, ベルフェ予約の有無, 添字 の辞書順で小さいものから取り出す
+ */
+class Frontier
+{
+public:
+	void clear()
+	{
+		heap.clear();
+	}
+	bool empty() const
+	{
+		return heap.empty();
+	}
+	void push(const Node& node, const uint32_t index)
+	{
+		heap.push_back(static_cast<uint64_t>(node.remain) << 33
+				| static_cast<uint64_t>(node.belphe_possible) << 32
+				| index);
+		std::push_heap(heap.begin(), heap.end(), std::greater<uint64_t>());
+	}
+	uint32_t pop()
+	{
+		std::pop_heap(heap.begin(), heap.end(), std::greater<uint64_t>());
+		const uint32_t index = static_cast<uint32_t>(heap.back());
+		heap.pop_back();
+		return index;
+	}
+
+private:
+	std::vector<uint64_t> heap;
+};
+
+static void apply(Node& next, uint64_t& hash, const card_type * const __restrict _cnt)
+{
+	const card_type * const __restrict cnt = util::assume_aligned<MAX_ALIGN>(_cnt);
+	for (int i = 0; i < 10; ++i)
+	{
+		if (cnt[i])
+		{
+			hash = zobrist.update(hash, i, next.hand[i], next.hand[i] - cnt[i]);
+			next.hand[i] -= cnt[i];
+			next.remain -= cnt[i];
+		}
+	}
+}
+
+static void action_count(const int32_t p, card_type * const __restrict _cnt)
+{
+	card_type * const __restrict cnt = util::assume_aligned<MAX_ALIGN>(_cnt);
+	std::fill(cnt, cnt + 10, 0);
+	for (int32_t x = p; x > 0; x /= 10)
+	{
+		++cnt[x % 10];
+	}
+}
+
+/**
+ * 置換表の WIN をたどって勝ち筋を復元する
+ *
+ * 途中で置き換えられていたら失敗
+ */
+static bool follow_table(const TranspositionTable& table, Node node, uint64_t hash, std::deque<int32_t>& actions)
+{
+	for (size_t step = 0; step < 64; ++step)
+	{
+		if (node.remain == 0 && !node.belphe_possible)
+		{
+			return true;
+		}
+		const auto entry = table.probe(hash);
+		if (!entry || entry->flag != TranspositionTable::WIN)
+		{
+			return false;
+		}
+		if (entry->action == ACTION_BELPHEGOR)
+		{
+			if (!node.belphe_possible)
+			{
+				return false;
+			}
+			node.belphe_possible = false;
+			hash = zobrist.toggle_belphe(hash);
+		}
+		else
+		{
+			ALIGNED hand_type cnt;
+			action_count(entry->action, cnt);
+			if (!is_possible(cnt, node.hand))
+			{
+				return false;
+			}
+			apply(node, hash, cnt);
+		}
+		actions.push_back(entry->action);
+	}
+	return false;
+}
+
+/**
+ * node から出せる手 (カット, ベルフェ, 残りすべてを使う素数) それぞれについて f(行動, 使う枚数) を呼ぶ
+ *
+ * ベルフェは枚数を nullptr で渡す。f が 1 回でも false を返したら false
+ */
+template <typename F>
+static bool for_each_action(const Node& node, F f)
+{
+	bool ok = true;
+	// max cut, mersenne cut
+	for (const auto& cut : cut_actions())
+	{
+		if (is_possible(cut.cnt, node.hand))
+		{
+			ok &= f(cut.number, cut.cnt);
+		}
+	}
+	// belphe cut
+	if (node.belphe_possible)
+	{
+		ok &= f(ACTION_BELPHEGOR, nullptr);
+	}
+	// 残りすべてで作れる素数は表から引く
+	if (node.remain <= prime_table::MAX_CARDS)
+	{
+		const auto primes = prime_table::multiset_primes().find(node.hand);
+		for (auto p = primes.first; p != primes.second; ++p)
+		{
+			ALIGNED hand_type cnt;
+			action_count(*p, cnt);
+			ok &= f(*p, cnt);
+		}
+	}
+	return ok;
+}
+
+/**
+ * 並列探索のスレッド 1 本分
+ *
+ * ノードは自分の arena に置き、添字の上位ビットにスレッド番号を入れて全体で一意にする
+ * frontier はほかのスレッドから盗まれるので mutex で守る
+ */
+constexpr int MAX_WORKERS = 16;
+constexpr int WORKER_SHIFT = 28;
+constexpr uint32_t LOCAL_MASK = (1u << WORKER_SHIFT) - 1;
+static_assert(MAX_WORKERS <= (1 << (32 - WORKER_SHIFT)), "Worker id does not fit in the index");
+
+struct Worker
+{
+	explicit Worker(const int id, const uint32_t capacity)
+			: id(id)
+			, arena(capacity) {}
+
+	const int id;
+	NodeArena arena;
+	std::mutex mutex;
+	Frontier tree;
+	std::vector<uint32_t> visited;      //!< SharedVisited で自分が埋めた番地
+	std::vector<uint64_t> children;     //!< 展開中の子 (frontier にまとめて入れる)
+	std::deque<int32_t> chain;          //!< 置換表から復元した勝ち筋
+	int64_t nodes;
+
+	void reset()
+	{
+		arena.clear();
+		tree.clear();
+		chain.clear();
+		nodes = 0;
+	}
+	uint32_t global(const uint32_t local) const
+	{
+		return static_cast<uint32_t>(id) << WORKER_SHIFT | local;
+	}
+	//! 子を arena に置き、flush までは frontier に入れない
+	bool add(const Node& next, const uint64_t hash)
+	{
+		if (arena.full())
+		{
+			return false;
+		}
+		children.push_back(global(arena.push(next, hash)));
+		return true;
+	}
+	bool add_child(const Node& parent, const uint64_t parent_hash, const uint32_t parent_index, const int32_t action, const card_type * const __restrict cnt)
+	{
+		Node next = parent;
+		uint64_t hash = parent_hash;
+		apply(next, hash, cnt);
+		++next.depth;
+		next.parent = parent_index;
+		next.action = action;
+		return add(next, hash);
+	}
+	bool add_child(const Node& parent, const uint64_t parent_hash, const uint32_t parent_index, const int32_t p)
+	{
+		ALIGNED hand_type cnt;
+		action_count(p, cnt);
+		return add_child(parent, parent_hash, parent_index, p, cnt);
+	}
+	bool add_belphe(const Node& parent, const uint64_t parent_hash, const uint32_t parent_index)
+	{
+		Node next = parent;
+		next.belphe_possible = false;
+		++next.depth;
+		next.parent = parent_index;
+		next.action = ACTION_BELPHEGOR;
+		return add(next, zobrist.toggle_belphe(parent_hash));
+	}
+	void flush()
+	{
+		if (children.empty())
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto index : children)
+		{
+			tree.push(arena[index & LOCAL_MASK], index);
+		}
+		children.clear();
+	}
+};
+
+/**
+ * work stealing による並列最良優先探索
+ *
+ * 各スレッドは自分の frontier から最良のノードを取り出し、空になったらほかのスレッドから盗む
+ * 誰かが勝ちを見つけたら全員止まる
+ */
+class ParallelSearch
+{
+public:
+	enum class result_t
+	{
+		FOUND,
+		EXHAUSTED,
+		CUTOFF,
+		TIMEOUT,
+	};
+
+	ParallelSearch(int num_workers, const TranspositionTable& table)
+			: table(table)
+	{
+		num_workers = std::min(std::max(num_workers, 1), MAX_WORKERS);
+		const uint32_t capacity = std::max<uint32_t>((1u << 20) / num_workers, 1u << 16);
+		for (int i = 0; i < num_workers; ++i)
+		{
+			workers.emplace_back(new Worker(i, capacity));
+		}
+	}
+
+	int size() const
+	{
+		return static_cast<int>(workers.size());
+	}
+	const Node& node(const uint32_t index) const
+	{
+		return workers[index >> WORKER_SHIFT]->arena[index & LOCAL_MASK];
+	}
+	uint64_t hash(const uint32_t index) const
+	{
+		return workers[index >> WORKER_SHIFT]->arena.hash(index & LOCAL_MASK);
+	}
+	uint32_t solution() const
+	{
+		return found.load();
+	}
+	//! 置換表をたどって足した勝ち筋 (見つけたノードを盗んでいたら、持ち主でなく見つけたスレッドのもの)
+	const std::deque<int32_t>& solution_chain() const
+	{
+		return workers[finder.load()]->chain;
+	}
+	int64_t nodes() const
+	{
+		int64_t ret = 0;
+		for (const auto& w : workers)
+		{
+			ret += w->nodes;
+		}
+		return ret;
+	}
+	//! 展開した状態すべてについて f(hash) を呼ぶ
+	template <typename F>
+	void for_each_visited(F f) const
+	{
+		for (const auto& w : workers)
+		{
+			for (const auto pos : w->visited)
+			{
+				f(visited.key(pos));
+			}
+		}
+	}
+
+	/**
+	 * 深さ制限 depth_limit で 1 回探索する
+	 *
+	 * 根は root、根の子は root_children (根を展開しないとき) として worker 0 に置く
+	 */
+	result_t run(const Node& root, const uint64_t root_hash, const std::vector<int32_t>& root_children, const bool expand_root,
+			const int depth_limit, const deadline_t& deadline, uint32_t& root_index)
+	{
+		for (auto& w : workers)
+		{
+			visited.clear(w->visited);
+			w->reset();
+		}
+		found.store(NO_PARENT);
+		finder.store(0);
+		cutoff.store(false);
+		stop.store(false);
+		timeout.store(false);
+		idle.store(0);
+
+		Worker& first = *workers[0];
+		root_index = first.global(first.arena.push(root, root_hash));
+		if (expand_root)
+		{
+			first.children.push_back(root_index);
+		}
+		else
+		{
+			for (const auto action : root_children)
+			{
+				if (action == ACTION_BELPHEGOR)
+				{
+					first.add_belphe(root, root_hash, root_index);
+				}
+				else
+				{
+					first.add_child(root, root_hash, root_index, action);
+				}
+			}
+		}
+		first.flush();
+
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < workers.size(); ++i)
+		{
+			threads.emplace_back([this, i, depth_limit, &deadline] { work(*workers[i], depth_limit, deadline); });
+		}
+		work(first, depth_limit, deadline);
+		for (auto& t : threads)
+		{
+			t.join();
+		}
+
+		if (found.load() != NO_PARENT)
+		{
+			return result_t::FOUND;
+		}
+		if (timeout.load())
+		{
+			return result_t::TIMEOUT;
+		}
+		return cutoff.load() ? result_t::CUTOFF : result_t::EXHAUSTED;
+	}
+
+private:
+	//! 自分の frontier から取り出す。空ならほかから盗む
+	bool take(Worker& self, uint32_t& index)
+	{
+		{
+			std::lock_guard<std::mutex> lock(self.mutex);
+			if (!self.tree.empty())
+			{
+				index = self.tree.pop();
+				return true;
+			}
+		}
+		const int n = size();
+		for (int k = 1; k < n; ++k)
+		{
+			Worker& victim = *workers[(self.id + k) % n];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tree.empty())
+			{
+				index = victim.tree.pop();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(Worker& self, const int depth_limit, const deadline_t& deadline)
+	{
+		bool is_idle = false;
+		for (int64_t iteration = 0; ; ++iteration)
+		{
+			if (stop.load(std::memory_order_relaxed))
+			{
+				return;
+			}
+			if ((iteration & 255) == 255 && (deadline.expired() || visited.full()))
+			{
+				timeout.store(true);
+				stop.store(true);
+				return;
+			}
+			// 取り出しを試す間は仕事中として数える (盗んだノードを手に持っている間に、全員が空に見えないように)
+			if (is_idle)
+			{
+				is_idle = false;
+				idle.fetch_sub(1);
+			}
+			uint32_t index;
+			if (!take(self, index))
+			{
+				is_idle = true;
+				// 全員が仕事を持っていなければ終わり (持ち主は自分の frontier から先に取るので、全員が空なら frontier も空)
+				if (idle.fetch_add(1) + 1 == size())
+				{
+					return;
+				}
+				std::this_thread::yield();
+				continue;
+			}
+			expand(self, index, depth_limit);
+			self.flush();
+		}
+	}
+
+	void expand(Worker& self, const uint32_t index, const int depth_limit)
+	{
+		const Node node = this->node(index);
+		const uint64_t hash = this->hash(index);
+
+		if (node.remain == 0 && node.belphe_possible == false)
+		{
+			self.chain.clear();
+			finish(self, index);
+			return;
+		}
+		if (const auto entry = table.probe(hash))
+		{
+			if (entry->flag == TranspositionTable::NO_WIN)
+			{
+				return;
+			}
+			if (entry->flag == TranspositionTable::WIN && follow_table(table, node, hash, self.chain))
+			{
+				finish(self, index);
+				return;
+			}
+			self.chain.clear();
+		}
+		if (is_dead(node))
+		{
+			return;
+		}
+		if (node.depth >= depth_limit)
+		{
+			cutoff.store(true, std::memory_order_relaxed);
+			return;
+		}
+		if (!visited.insert(hash, node.depth, self.visited))
+		{
+			return;
+		}
+		++self.nodes;
+
+		const bool ok = for_each_action(node, [&](const int32_t action, const card_type * const cnt) {
+			return cnt ? self.add_child(node, hash, index, action, cnt) : self.add_belphe(node, hash, index);
+		});
+		if (!ok)
+		{
+			DBG("arena is full");
+			timeout.store(true);
+			stop.store(true);
+		}
+	}
+
+	//! 最初に見つけたものだけを採用して全員を止める。勝ち筋の続きは見つけた self の chain にある
+	void finish(const Worker& self, const uint32_t index)
+	{
+		uint32_t expected = NO_PARENT;
+		if (found.compare_exchange_strong(expected, index))
+		{
+			finder.store(self.id);
+		}
+		stop.store(true);
+	}
+
+	const TranspositionTable& table;
+	std::vector<std::unique_ptr<Worker>> workers;
+	SharedVisited visited;
+	std::atomic<uint32_t> found{NO_PARENT};
+	std::atomic<int> finder{0};     //!< found を見つけたスレッド
+	std::atomic<bool> cutoff{false};
+	std::atomic<bool> stop{false};
+	std::atomic<bool> timeout{false};
+	std::atomic<int> idle{0};
+};
+
+/**
+ * beam stack search
+ *
+ * 深さごとに、1 つ浅いビームから作った子を優先度 (残り枚数, ベルフェ予約) 順に並べ、width 個ずつをビームとして深さ優先に進む
+ * 行き詰まったら同じ深さの次の width 個に切り替え、調べ尽くしたら 1 つ浅い深さに戻るので、
+ * メモリは 深さ x width x 分岐数 で抑えつつ、時間があればすべての状態を調べ尽くす
+ * ある深さの子を調べ尽くしたら 1 つ浅いビームはどれも勝てないので、置換表に NO_WIN を置く
+ */
+class BeamStackSearch
+{
+public:
+	using result_t = ParallelSearch::result_t;
+
+	explicit BeamStackSearch(const size_t width)
+			: width(std::max<size_t>(width, 1)) {}
+
+	int64_t nodes() const
+	{
+		return expanded;
+	}
+
+	/**
+	 * 勝ち筋を探す
+	 *
+	 * 見つけたら actions に行動を、path にそれぞれの行動を取った状態の hash を根から順に入れる
+	 * 根の子は root_children (根を展開しないとき)
+	 */
+	result_t run(const Node& root, const uint64_t root_hash, const std::vector<int32_t>& root_children, const bool expand_root,
+			TranspositionTable& table, const deadline_t& deadline, std::deque<int32_t>& actions, std::deque<uint64_t>& path)
+	{
+		layers.clear();
+		expanded = 0;
+		layers.emplace_back();
+		if (expand_root)
+		{
+			layers.back().push(root, root_hash);
+		}
+		else
+		{
+			for (const auto action : root_children)
+			{
+				ALIGNED hand_type cnt;
+				if (action != ACTION_BELPHEGOR)
+				{
+					action_count(action, cnt);
+				}
+				layers.back().push_child(root, root_hash, NO_PARENT, action, action == ACTION_BELPHEGOR ? nullptr : cnt);
+			}
+		}
+		layers.back().sort();
+
+		std::deque<int32_t> chain;
+		while (!layers.empty())
+		{
+			if (deadline.expired())
+			{
+				return result_t::TIMEOUT;
+			}
+			Layer& top = layers.back();
+			if (top.offset >= top.entries.size())
+			{
+				// この深さを調べ尽くしたので 1 つ浅いビームはどれも勝てない
+				layers.pop_back();
+				if (!layers.empty())
+				{
+					give_up(layers.back(), table);
+				}
+				continue;
+			}
+
+			Layer next;
+			const size_t end = std::min(top.offset + width, top.entries.size());
+			for (size_t i = top.offset; i < end; ++i)
+			{
+				const Node& node = top.entries[i].node;
+				const uint64_t hash = top.entries[i].hash;
+				if (node.remain == 0 && node.belphe_possible == false)
+				{
+					trace(i, root_hash, expand_root, actions, path);
+					return result_t::FOUND;
+				}
+				if (const auto entry = table.probe(hash))
+				{
+					if (entry->flag == TranspositionTable::NO_WIN)
+					{
+						continue;
+					}
+					chain.clear();
+					if (entry->flag == TranspositionTable::WIN && follow_table(table, node, hash, chain))
+					{
+						trace(i, root_hash, expand_root, actions, path);
+						actions.insert(actions.end(), chain.begin(), chain.end());
+						return result_t::FOUND;
+					}
+				}
+				if (is_dead(node))
+				{
+					continue;
+				}
+				++expanded;
+				for_each_action(node, [&](const int32_t action, const card_type * const cnt) {
+					next.push_child(node, hash, static_cast<uint32_t>(i), action, cnt);
+					return true;
+				});
+			}
+			next.sort();
+			if (next.entries.empty())
+			{
+				// 行き詰まったので同じ深さの次のビームへ
+				give_up(top, table);
+				continue;
+			}
+			layers.push_back(std::move(next));
+		}
+		return result_t::EXHAUSTED;
+	}
+
+private:
+	struct Entry
+	{
+		Node node;
+		uint64_t hash;
+	};
+	struct Layer
+	{
+		std::vector<Entry> entries;
+		size_t offset = 0;
+
+		void push(const Node& node, const uint64_t hash)
+		{
+			entries.push_back(Entry{node, hash});
+		}
+		//! cnt が nullptr ならベルフェ
+		void push_child(const Node& parent, uint64_t hash, const uint32_t parent_index, const int32_t action, const card_type * const cnt)
+		{
+			Node next = parent;
+			if (cnt)
+			{
+				apply(next, hash, cnt);
+			}
+			else
+			{
+				next.belphe_possible = false;
+				hash = zobrist.toggle_belphe(hash);
+			}
+			++next.depth;
+			next.parent = parent_index;
+			next.action = action;
+			push(next, hash);
+		}
+		//! 優先度順に並べ、同じ状態は 1 つにする
+		void sort()
+		{
+			const auto key = [](const Entry& e) {
+				return std::make_tuple(e.node.remain, e.node.belphe_possible, e.hash);
+			};
+			std::sort(entries.begin(), entries.end(), [&key](const Entry& a, const Entry& b) {
+				return key(a) < key(b);
+			});
+			entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+				return a.hash == b.hash;
+			}), entries.end());
+		}
+	};
+
+	//! layer の今のビームを勝てないとして次のビームに進める
+	void give_up(Layer& layer, TranspositionTable& table)
+	{
+		const size_t end = std::min(layer.offset + width, layer.entries.size());
+		for (size_t i = layer.offset; i < end; ++i)
+		{
+			table.store(layer.entries[i].hash, TranspositionTable::NO_WIN);
+		}
+		layer.offset += width;
+	}
+
+	//! 一番深いビームの index 番目から根までたどる
+	void trace(uint32_t index, const uint64_t root_hash, const bool expand_root, std::deque<int32_t>& actions, std::deque<uint64_t>& path) const
+	{
+		actions.clear();
+		path.clear();
+		for (size_t l = layers.size(); l-- > 0;)
+		{
+			if (expand_root && l == 0)
+			{
+				break;
+			}
+			const Node& node = layers[l].entries[index].node;
+			actions.push_front(node.action);
+			path.push_front(l > 0 ? layers[l - 1].entries[node.parent].hash : root_hash);
+			index = node.parent;
+		}
+	}
+
+	const size_t width;
+	std::vector<Layer> layers;
+	int64_t expanded = 0;
+};
+}
+
+/**
+ * 手札が少ないときの厳密な勝ち判定
+ *
+ * 親の状態 (手札の枚数分布, ベルフェ予約) について、カット (メルセンヌ, マックス, ベルフェ) だけで
+ * 最後に手札を出し切れるかをメモ化再帰で調べる
+ * 親でない状態は根にしか現れないので、根の応手だけ別に列挙する
+ * 枚数分布は合計 MAX_CARDS 枚以下の組み合わせの中での順位で完全ハッシュする
+ */
+namespace endgame
+{
+constexpr int MAX_CARDS = 12;
+constexpr int MAX_PERMUTATIONS = 5000;
+
+class Memo
+{
+public:
+	enum Value : uint8_t
+	{
+		UNKNOWN = 0,
+		LOSE,
+		WIN,
+	};
+
+	Memo()
+		: values(2 * rank.size(), UNKNOWN)
+	{
+	}
+
+	uint8_t& operator()(const card_type * const hand, const bool belphe)
+	{
+		return values[rank(hand) * 2 + belphe];
+	}
+
+private:
+	MultisetRank<MAX_CARDS> rank;
+	std::vector<uint8_t> values;
+};
+
+/**
+ * 手札をすべて使って min 以上の素数を作る
+ *
+ * 5 枚以下 (7 枚の表ができていれば 7 枚以下) なら表の最大の素数、それより多ければ大きい並びから順に調べ、MAX_PERMUTATIONS 通りで諦める
+ */
+static bool find_prime_arrangement(const card_type * const hand, const mpz_class& min, std::string& out)
+{
+	std::string digits;
+	for (int i = 9; i >= 0; --i)
+	{
+		digits.append(hand[i], static_cast<char>('0' + i));
+	}
+	if (digits.empty())
+	{
+		return false;
+	}
+	const int n = static_cast<int>(digits.size());
+	if (n <= prime_table::MAX_CARDS || (n <= prime_table::ANAGRAM_CARDS && prime_table::anagram_primes().ready()))
+	{
+		const auto primes = n <= prime_table::MAX_CARDS
+			? prime_table::multiset_primes().find(hand)
+			: prime_table::anagram_primes().find(hand);
+		if (primes.first == primes.second || *(primes.second - 1) < min)
+		{
+			return false;
+		}
+		out = std::to_string(*(primes.second - 1));
+		return true;
+	}
+	mpz_class x;
+	int count = 0;
+	do
+	{
+		if (digits[0] == '0')
+		{
+			break;
+		}
+		x.set_str(digits, 10);
+		if (x < min)
+		{
+			break;
+		}
+		if (is_prime(x.get_mpz_t()))
+		{
+			out = digits;
+			return true;
+		}
+	} while (++count < MAX_PERMUTATIONS && std::prev_permutation(digits.begin(), digits.end()));
+	return false;
+}
+
+//! 手札だけで決まる結果なので、スレッドごとに 1 つを共有する
+static Memo& memo()
+{
+	thread_local Memo instance;
+	return instance;
+}
+
+static int count_cards(const card_type * const hand)
+{
+	int ret = 0;
+	for (int i = 0; i < 10; ++i)
+	{
+		ret += hand[i];
+	}
+	return ret;
+}
+
+/**
+ * 親の状態から勝てるか
+ *
+ * plan が非 null なら勝ち筋を積む
+ */
+static bool win(card_type * const hand, const bool belphe, std::deque<std::string>* plan)
+{
+	const int remain = count_cards(hand);
+	if (remain == 0 && !belphe)
+	{
+		return true;
+	}
+	uint8_t& value = memo()(hand, belphe);
+	if (value != Memo::UNKNOWN && (value == Memo::LOSE || !plan))
+	{
+		return value == Memo::WIN;
+	}
+
+	bool ret = false;
+	// max cut, mersenne cut
+	for (const auto& cut : win_search::cut_actions())
+	{
+		if (!is_possible(cut.cnt, hand))
+		{
+			continue;
+		}
+		for (int i = 0; i < 10; ++i)
+		{
+			hand[i] -= cut.cnt[i];
+		}
+		ret = win(hand, belphe, plan);
+		for (int i = 0; i < 10; ++i)
+		{
+			hand[i] += cut.cnt[i];
+		}
+		if (ret)
+		{
+			if (plan)
+			{
+				plan->push_front(std::to_string(cut.number));
+			}
+			break;
+		}
+	}
+	// belphe cut
+	if (!ret && belphe && win(hand, false, plan))
+	{
+		ret = true;
+		if (plan)
+		{
+			plan->push_front(belphegor::BELPHEGOR_PRIME_STR);
+		}
+	}
+	// 最後の 1 手: 出し切ればベルフェが残っていても次の手番で出せる
+	std::string last;
+	if (!ret && remain > 0 && remain <= NUM_FIRST_CARDS && find_prime_arrangement(hand, 0_mpz, last))
+	{
+		ret = true;
+		if (plan)
+		{
+			if (belphe)
+			{
+				plan->push_front(belphegor::BELPHEGOR_PRIME_STR);
+			}
+			plan->push_front(last);
+		}
+	}
+
+	value = ret ? Memo::WIN : Memo::LOSE;
+	return ret;
+}
+
+/**
+ * 根 (親なら length = 0、そうでなければ場の桁数 length と直前の数 prev) から勝てるか調べ、勝ち筋を plan に入れる
+ */
+static bool solve(const card_type * const _hand, const bool belphe, const int length, const mpz_class& prev, std::deque<std::string>& plan)
+{
+	ALIGNED hand_type hand;
+	std::memcpy(hand, _hand, sizeof(hand));
+	plan.clear();
+	if (length == 0)
+	{
+		return win(hand, belphe, &plan);
+	}
+
+	// 親でないときは、場の桁数のメルセンヌかベルフェで親を取るか、出し切る
+	// (最大の素数で親を取れるのは親のときだけ。返した後の場は倍の桁数になる)
+	if (length <= 10)
+	{
+		for (const auto p : mersenne_check(length, prev.get_si(), hand))
+		{
+			ALIGNED hand_type cnt = {0};
+			for (int64_t x = p; x > 0; x /= 10)
+			{
+				++cnt[x % 10];
+			}
+			for (int i = 0; i < 10; ++i)
+			{
+				hand[i] -= cnt[i];
+			}
+			const bool ret = win(hand, belphe, &plan);
+			for (int i = 0; i < 10; ++i)
+			{
+				hand[i] += cnt[i];
+			}
+			if (ret)
+			{
+				plan.push_front(std::to_string(p));
+				return true;
+			}
+		}
+	}
+	if (belphe && win(hand, false, &plan))
+	{
+		plan.push_front(belphegor::BELPHEGOR_PRIME_STR);
+		return true;
+	}
+	std::string last;
+	if (count_cards(hand) == length && find_prime_arrangement(hand, prev, last))
+	{
+		if (belphe)
+		{
+			plan.push_front(belphegor::BELPHEGOR_PRIME_STR);
+		}
+		plan.push_front(last);
+		return true;
+	}
+	plan.clear();
+	return false;
+}
+}
+
+/**
+ * 出した手が相手に返されるかの見積もり
+ *
+ * 見えていない札 (山札と相手の手札) は各数字が独立に配られているとみなし、
+ * 相手それぞれが同じ数 (同値は出せる) かベルフェゴール素数を持っている確率を二項分布で求める
+ * メルセンヌとベルフェは場が流れ、手札を出し切れば勝ちなので返されない
+ * 同じ数かベルフェでしか返せないのは親として出した手だけで、場に返した手は次の人が倍の桁数で返せる
+ */
+namespace threat
+{
+enum Safety : uint8_t
+{
+	UNBEATABLE,   //!< 返されない
+	LIKELY,       //!< 相手が持っていそうにない
+	BEATABLE,     //!< 返されうる
+};
+constexpr double LIKELY_THRESHOLD = 0.1;
+constexpr int DECK_PER_DIGIT = 300;
+
+struct view_t
+{
+	ALIGNED int unseen[10];          //!< 自分の手札とこれまでに出た札以外の枚数
+	int total;
+	std::vector<int> opponents;      //!< 相手の手札の枚数
+};
+
+/**
+ * 手番の始めに見えている札から view を作る
+ *
+ * hand は自分の手札 (ベルフェの予約前)、played はこれまでに出た数字ごとの枚数
+ */
+static void observe(view_t& view, const card_type * const hand, const int * const played, const std::vector<std::pair<std::string, card_type>>& hands, const std::string& name)
+{
+	view.total = 0;
+	for (int i = 0; i < 10; ++i)
+	{
+		view.unseen[i] = std::max(0, DECK_PER_DIGIT + (i == 0) - hand[i] - played[i]);
+		view.total += view.unseen[i];
+	}
+	view.opponents.clear();
+	for (const auto& h : hands)
+	{
+		if (h.first != name)
+		{
+			view.opponents.push_back(h.second);
+		}
+	}
+}
+
+//! n 枚配られて数字 d が k 枚以上ある確率
+static double at_least(const view_t& view, const int n, const int d, const int k)
+{
+	if (k <= 0)
+	{
+		return 1.0;
+	}
+	if (n < k || view.total == 0)
+	{
+		return 0.0;
+	}
+	const double q = static_cast<double>(view.unseen[d]) / view.total;
+	if (q >= 1.0)
+	{
+		return 1.0;
+	}
+	double pmf = std::pow(1.0 - q, n);
+	double below = 0.0;
+	for (int i = 0; i < k; ++i)
+	{
+		below += pmf;
+		pmf *= static_cast<double>(n - i) / (i + 1) * q / (1.0 - q);
+	}
+	return std::max(0.0, 1.0 - below);
+}
+
+//! n 枚の手札に cnt が揃っている確率
+static double holds(const view_t& view, const int n, const card_type * const cnt)
+{
+	double ret = 1.0;
+	for (int i = 0; i < 10 && ret > 0.0; ++i)
+	{
+		ret *= at_least(view, n, i, cnt[i]);
+	}
+	return ret;
+}
+
+static bool is_mersenne(const std::string& action)
+{
+	for (const char* m : {"3", "7", "31", "127", "8191", "131071", "524287", "2147483647"})
+	{
+		if (action == m)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * action を出して親を取れない確率
+ *
+ * finishes なら出し切って勝つので 0
+ * lead でない (場に返す) 手は、次の人が倍の桁数のより大きい素数で返せるので 1
+ */
+static double beat_probability(const view_t& view, const std::string& action, const bool lead, const bool finishes)
+{
+	if (finishes || action == belphegor::BELPHEGOR_PRIME_STR || is_mersenne(action))
+	{
+		return 0.0;
+	}
+	if (!lead || static_cast<int>(action.size()) > NUM_FIRST_CARDS)
+	{
+		return 1.0;
+	}
+	ALIGNED hand_type cnt = {0};
+	for (const char c : action)
+	{
+		++cnt[c - '0'];
+	}
+	ALIGNED hand_type belphe = {0};
+	for (const char c : std::string(belphegor::BELPHEGOR_PRIME_STR))
+	{
+		++belphe[c - '0'];
+	}
+	double keep = 1.0;
+	for (const int n : view.opponents)
+	{
+		const double same = holds(view, n, cnt);
+		const double cut = holds(view, n, belphe);
+		keep *= (1.0 - same) * (1.0 - cut);
+	}
+	return 1.0 - keep;
+}
+
+static Safety classify(const view_t& view, const std::string& action, const bool lead, const bool finishes)
+{
+	if (finishes || action == belphegor::BELPHEGOR_PRIME_STR || is_mersenne(action))
+	{
+		return UNBEATABLE;
+	}
+	// 場に返す手は次の人が倍の桁数で返せる
+	if (!lead || static_cast<int>(action.size()) > NUM_FIRST_CARDS)
+	{
+		return BEATABLE;
+	}
+	// 最大の素数でなければより大きい数で返される
+	const int32_t max_cut = prime_table::max_prime(static_cast<int>(action.size()));
+	if (max_cut == 0 || std::stoi(action) != max_cut)
+	{
+		return BEATABLE;
+	}
+	const double p = beat_probability(view, action, true, false);
+	return p == 0.0 ? UNBEATABLE : p < LIKELY_THRESHOLD ? LIKELY : BEATABLE;
+}
+}
+
+/**
+ * 勝ち筋の DAG
+ *
+ * 状態 (手札の枚数分布, ベルフェ予約) ごとに、親のときに出せる手と、場の桁数ごとに親を取り返せる応手を持つ
+ * 行き先はどれも勝ちと分かっている状態で、手番が回ってきたら今の状態を引いて次の手を選ぶ
+ * 行き先の勝ち筋は、DAG -> 厳密解 (endgame) -> 置換表 の順に探す
+ * 選ぶときは threat の見積もりで最後まで返されない確率が最も高い手にする
+ *
+ * table と view は持ち主 (search_state_t) のものを見る
+ */
+class WinPlan
+{
+public:
+	static constexpr int MAX_REPLY_LENGTH = 10;
+	static constexpr size_t MAX_NODES = 64;
+
+	WinPlan(const win_search::TranspositionTable& table, const threat::view_t& view)
+			: table(table)
+			, view(view) {}
+
+	void clear()
+	{
+		nodes.clear();
+	}
+
+	bool empty() const
+	{
+		return nodes.empty();
+	}
+
+	/**
+	 * 根から line の順に出すと勝てる、として DAG を作り直し、応手を足す
+	 *
+	 * length > 0 なら最初の手は場の桁数 length への応手
+	 */
+	void build(const card_type * const hand, const bool belphe, const int length, const std::deque<std::string>& line, const deadline_t& deadline)
+	{
+		clear();
+		std::vector<uint64_t> added;
+		merge(hand, belphe, length, line, added);
+		for (size_t i = 0; i < added.size() && !deadline.expired(); ++i)
+		{
+			expand(added[i], added);
+		}
+	}
+
+	/**
+	 * 今の状態で出す手
+	 *
+	 * DAG に無いか、場に出せる応手が無ければ nullptr
+	 */
+	const std::string* next(const card_type * const hand, const bool belphe, const int length, const mpz_class& prev) const
+	{
+		const uint64_t hash = win_search::zobrist.hash(hand, belphe);
+		const auto it = nodes.find(hash);
+		if (it == nodes.end() || !std::equal(hand, hand + 10, it->second.hand))
+		{
+			return nullptr;
+		}
+		const PlanNode& node = it->second;
+		std::unordered_map<uint64_t, double> memo;
+		const std::string* ret = nullptr;
+		double best = -1.0;
+		const auto consider = [&](const std::string& action) {
+			const double p = safe_probability(node, action, length == 0, memo);
+			if (p > best)
+			{
+				best = p;
+				ret = &action;
+			}
+		};
+		if (length == 0)
+		{
+			for (const auto& action : node.leads)
+			{
+				consider(action);
+			}
+		}
+		else
+		{
+			if (length <= MAX_REPLY_LENGTH)
+			{
+				for (const auto& action : node.replies[length])
+				{
+					if (mpz_class(action) >= prev)
+					{
+						consider(action);
+					}
+				}
+			}
+			if (node.belphe_reply)
+			{
+				consider(belphe_str);
+			}
+		}
+		if (ret)
+		{
+			DBG(*ret);
+			DBG(best);
+		}
+		return ret;
+	}
+
+private:
+	struct PlanNode
+	{
+		ALIGNED hand_type hand;
+		bool belphe;
+		std::vector<std::string> leads;                             //!< 親のときに出せる手
+		std::vector<std::string> replies[MAX_REPLY_LENGTH + 1];     //!< 場の桁数ごとの応手 (大きい順)
+		bool belphe_reply;                                          //!< ベルフェで親を取り返せる
+	};
+
+	static int remain_after(const PlanNode& node, const std::string& action)
+	{
+		int ret = 0;
+		for (const auto c : node.hand)
+		{
+			ret += c;
+		}
+		return action == belphegor::BELPHEGOR_PRIME_STR ? ret : ret - static_cast<int>(action.size());
+	}
+
+	/**
+	 * node で action を出してから最後まで返されない確率
+	 *
+	 * lead なら親として出す手、でなければ場への応手。行き先では親として最も確率の高い手を選ぶとする
+	 */
+	double safe_probability(const PlanNode& node, const std::string& action, const bool lead, std::unordered_map<uint64_t, double>& memo) const
+	{
+		ALIGNED hand_type next;
+		std::memcpy(next, node.hand, sizeof(next));
+		bool belphe = node.belphe;
+		if (action == belphegor::BELPHEGOR_PRIME_STR)
+		{
+			belphe = false;
+		}
+		else
+		{
+			for (const char c : action)
+			{
+				--next[c - '0'];
+			}
+		}
+		const bool finishes = remain_after(node, action) == 0 && !belphe;
+		const double step = 1.0 - threat::beat_probability(view, action, lead, finishes);
+		if (finishes)
+		{
+			return step;
+		}
+		const uint64_t hash = win_search::zobrist.hash(next, belphe);
+		const auto hit = memo.find(hash);
+		if (hit != memo.end())
+		{
+			return step * hit->second;
+		}
+		double best = 0.0;
+		const auto it = nodes.find(hash);
+		if (it != nodes.end())
+		{
+			for (const auto& next_lead : it->second.leads)
+			{
+				best = std::max(best, safe_probability(it->second, next_lead, true, memo));
+			}
+		}
+		memo.emplace(hash, best);
+		return step * best;
+	}
+
+	PlanNode& insert(const card_type * const hand, const bool belphe, std::vector<uint64_t>& added)
+	{
+		const uint64_t hash = win_search::zobrist.hash(hand, belphe);
+		auto it = nodes.find(hash);
+		if (it == nodes.end())
+		{
+			it = nodes.emplace(hash, PlanNode()).first;
+			std::memcpy(it->second.hand, hand, sizeof(hand_type));
+			it->second.belphe = belphe;
+			it->second.belphe_reply = false;
+			added.push_back(hash);
+		}
+		return it->second;
+	}
+
+	/**
+	 * (hand, belphe) から line の順に出す道筋を足す
+	 *
+	 * 手札で出せない手が現れたらそこで打ち切る
+	 */
+	void merge(const card_type * const _hand, bool belphe, int length, const std::deque<std::string>& line, std::vector<uint64_t>& added)
+	{
+		ALIGNED hand_type hand;
+		std::memcpy(hand, _hand, sizeof(hand));
+		for (const auto& action : line)
+		{
+			int remain = 0;
+			for (const auto c : hand)
+			{
+				remain += c;
+			}
+			if (remain == 0 && !belphe)
+			{
+				return;
+			}
+			PlanNode& node = insert(hand, belphe, added);
+			if (action == belphegor::BELPHEGOR_PRIME_STR)
+			{
+				if (!belphe)
+				{
+					return;
+				}
+				if (length > 0)
+				{
+					node.belphe_reply = true;
+				}
+				else
+				{
+					add_lead(node, action);
+				}
+				belphe = false;
+			}
+			else
+			{
+				ALIGNED hand_type cnt = {0};
+				for (const char c : action)
+				{
+					++cnt[c - '0'];
+				}
+				if (!is_possible(cnt, hand))
+				{
+					return;
+				}
+				if (length > 0)
+				{
+					if (length <= MAX_REPLY_LENGTH && static_cast<int>(action.size()) == length)
+					{
+						add_reply(node, action);
+					}
+				}
+				else
+				{
+					add_lead(node, action);
+				}
+				for (int i = 0; i < 10; ++i)
+				{
+					hand[i] -= cnt[i];
+				}
+			}
+			length = 0;
+		}
+	}
+
+	static void add_lead(PlanNode& node, const std::string& action)
+	{
+		if (std::find(node.leads.begin(), node.leads.end(), action) == node.leads.end())
+		{
+			node.leads.push_back(action);
+		}
+	}
+
+	static void add_reply(PlanNode& node, const std::string& action)
+	{
+		auto& replies = node.replies[action.size()];
+		if (std::find(replies.begin(), replies.end(), action) == replies.end())
+		{
+			replies.push_back(action);
+			std::sort(replies.begin(), replies.end(), std::greater<std::string>());
+		}
+	}
+
+	/**
+	 * 親で出せるカットと出し切り、場の桁数ごとに親を取り返せる手 (メルセンヌ, ベルフェ) を試し、
+	 * 行き先が勝ちなら別の手として足す
+	 */
+	void expand(const uint64_t hash, std::vector<uint64_t>& added)
+	{
+		PlanNode& node = nodes.at(hash);
+		ALIGNED hand_type hand;
+		std::memcpy(hand, node.hand, sizeof(hand));
+		const bool belphe = node.belphe;
+		int remain = 0;
+		for (const auto c : hand)
+		{
+			remain += c;
+		}
+		for (const auto& cut : win_search::cut_actions())
+		{
+			if (!is_possible(cut.cnt, hand))
+			{
+				continue;
+			}
+			ALIGNED hand_type next;
+			for (int i = 0; i < 10; ++i)
+			{
+				next[i] = hand[i] - cut.cnt[i];
+			}
+			if (resolve(next, belphe, added))
+			{
+				add_lead(node, std::to_string(cut.number));
+			}
+		}
+		if (0 < remain && remain <= prime_table::MAX_CARDS)
+		{
+			const auto primes = prime_table::multiset_primes().find(hand);
+			const hand_type empty = {0};
+			if (primes.first != primes.second && resolve(empty, belphe, added))
+			{
+				add_lead(node, std::to_string(*(primes.second - 1)));
+			}
+		}
+		for (int length = 1; length <= MAX_REPLY_LENGTH; ++length)
+		{
+			// 最大の素数は返した後の場が倍の桁数になるので親を取れない
+			for (const auto p : mersenne_check(length, -1, hand))
+			{
+				ALIGNED hand_type next;
+				std::memcpy(next, hand, sizeof(next));
+				for (int64_t x = p; x > 0; x /= 10)
+				{
+					--next[x % 10];
+				}
+				if (resolve(next, belphe, added))
+				{
+					add_reply(node, std::to_string(p));
+				}
+			}
+		}
+		if (belphe && resolve(hand, false, added))
+		{
+			node.belphe_reply = true;
+			add_lead(node, belphegor::BELPHEGOR_PRIME_STR);
+		}
+	}
+
+	//! 親の状態 (hand, belphe) が勝ちなら、必要に応じて勝ち筋を DAG に足す
+	bool resolve(const card_type * const hand, const bool belphe, std::vector<uint64_t>& added)
+	{
+		int remain = 0;
+		for (int i = 0; i < 10; ++i)
+		{
+			remain += hand[i];
+		}
+		if (remain == 0 && !belphe)
+		{
+			return true;
+		}
+		const uint64_t hash = win_search::zobrist.hash(hand, belphe);
+		const auto it = nodes.find(hash);
+		if (it != nodes.end())
+		{
+			return it->second.leads.size() > 0;
+		}
+		if (nodes.size() >= MAX_NODES)
+		{
+			return false;
+		}
+		std::deque<std::string> line;
+		if (remain <= endgame::MAX_CARDS)
+		{
+			ALIGNED hand_type work;
+			std::memcpy(work, hand, sizeof(work));
+			if (!endgame::win(work, belphe, &line))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			win_search::Node node;
+			std::memcpy(node.hand, hand, sizeof(node.hand));
+			node.remain = remain;
+			node.belphe_possible = belphe;
+			node.depth = 0;
+			node.parent = win_search::NO_PARENT;
+			node.action = 0;
+			std::deque<int32_t> actions;
+			if (!win_search::follow_table(table, node, hash, actions))
+			{
+				return false;
+			}
+			for (const auto action : actions)
+			{
+				line.push_back(action == win_search::ACTION_BELPHEGOR ? belphegor::BELPHEGOR_PRIME_STR : std::to_string(action));
+			}
+		}
+		merge(hand, belphe, 0, line, added);
+		return true;
+	}
+
+	const win_search::TranspositionTable& table;
+	const threat::view_t& view;
+	std::unordered_map<uint64_t, PlanNode> nodes;
+	const std::string belphe_str = belphegor::BELPHEGOR_PRIME_STR;
+};
+constexpr int WinPlan::MAX_REPLY_LENGTH;
+constexpr size_t WinPlan::MAX_NODES;
+
+/**
+ * 直近の search_win の統計
+ *
+ * 持ち時間の調整に使う
+ */
+struct search_stats_t
+{
+	int64_t nodes;      //!< 展開したノード数
+	double elapsed;     //!< 秒
+	int depth;          //!< 最後に探索した深さ制限
+	bool exhausted;     //!< 探索し尽くして勝ちがないと分かった
+	bool win;           //!< 勝ち筋が見つかった
+	threat::Safety safety;  //!< 勝ち筋の今の手番の手が返されるか
+};
+
+/**
+ * 勝ち確定探索の 1 人分の状態
+ *
+ * 置換表と勝ち筋は手番をまたいで使い回す
+ */
+struct search_state_t
+{
+	win_search::TranspositionTable table;
+	uint64_t hand_hash;
+	ALIGNED hand_type hashed_hand;
+	bool hashed_belphe;
+	threat::view_t view;
+	search_stats_t stats;
+	WinPlan plan;
+	std::string move;   //!< search_win が見つけた今の手番の手 (なければ空)
+	std::unique_ptr<win_search::BeamStackSearch> beam;
+	std::unique_ptr<win_search::ParallelSearch> searcher;
+
+	search_state_t()
+			: hashed_hand{0}
+			, hashed_belphe(false)
+			, plan(table, view)
+	{
+		hand_hash = win_search::zobrist.hash(hashed_hand, false);
+	}
+
+	/**
+	 * hand の hash を前回から変わった数字の分だけ更新する
+	 */
+	uint64_t update_hand_hash(const card_type * const hand, const bool belphe_possible)
+	{
+		for (int i = 0; i < 10; ++i)
+		{
+			if (hashed_hand[i] != hand[i])
+			{
+				hand_hash = win_search::zobrist.update(hand_hash, i, hashed_hand[i], hand[i]);
+				hashed_hand[i] = hand[i];
+			}
+		}
+		if (hashed_belphe != belphe_possible)
+		{
+			hand_hash = win_search::zobrist.toggle_belphe(hand_hash);
+			hashed_belphe = belphe_possible;
+		}
+		return hand_hash;
+	}
+};
+
+/**
+ * 根からの勝ち筋 line で search.plan を作り直し、今の手番の手を search.move に入れる
+ *
+ * 手は DAG の中で最も返されにくいものを選ぶ
+ * line が空なら勝ち筋を捨てる
+ */
+static void publish_plan(const solver_state_t& state, search_state_t& search, const bool belphe_possible, const int length, const mpz_class& prev, const std::deque<std::string>& line, const deadline_t& deadline)
+{
+	if (line.empty())
+	{
+		search.plan.clear();
+		return;
+	}
+	search.plan.build(state.hand, belphe_possible, length, line, deadline);
+	const auto move = search.plan.next(state.hand, belphe_possible, length, prev);
+	search.move = move ? *move : line.front();
+	int remain = 0;
+	for (const auto c : state.hand)
+	{
+		remain += c;
+	}
+	const bool finishes = search.move != belphegor::BELPHEGOR_PRIME_STR && !belphe_possible
+			&& static_cast<int>(search.move.size()) == remain;
+	search.stats.safety = threat::classify(search.view, search.move, length == 0, finishes);
+}
+
+static void search_win(const solver_state_t& state, search_state_t& search, const bool belphe_possible, const int length, const mpz_class& prev, const deadline_t& deadline)
+{
+	using namespace win_search;
+	search_stats_t& stats = search.stats;
+	TranspositionTable& table = search.table;
+
+	// すでに確立していたら今の状態の手を引く
+	search.move.clear();
+	if (const auto move = search.plan.next(state.hand, belphe_possible, length, prev))
+	{
+		search.move = *move;
+		return;
+	}
+
+	const auto search_start = clock_type::now();
+	stats = search_stats_t{0, 0.0, 0, false, false, threat::UNBEATABLE};
+	struct report_t
+	{
+		search_stats_t& stats;
+		clock_type::time_point start;
+		~report_t()
+		{
+			stats.elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+#ifdef SEARCH_STATS
+			std::cerr << "search_win: nodes " << stats.nodes
+			          << ", time " << stats.elapsed * 1e3 << " ms"
+			          << ", nps " << (stats.elapsed > 0 ? stats.nodes / stats.elapsed : 0.0)
+			          << ", depth " << stats.depth
+			          << ", exhausted " << stats.exhausted
+			          << ", win " << stats.win
+			          << ", safety " << static_cast<int>(stats.safety) << std::endl;
+#endif
+		}
+	} report{stats, search_start};
+
+	// 手札が少なければ厳密に解く
+	if (state.num_hand <= endgame::MAX_CARDS)
+	{
+		std::deque<std::string> line;
+		stats.win = endgame::solve(state.hand, belphe_possible, length, prev, line);
+		stats.exhausted = !stats.win;
+		publish_plan(state, search, belphe_possible, length, prev, line, deadline);
+		return;
+	}
+
+	table.next_generation();
+
+	Node initial_state;
+	std::memcpy(initial_state.hand, state.hand, sizeof(state.hand));
+	initial_state.remain = 0;
+	for (const auto c : initial_state.hand)
+	{
+		initial_state.remain += c;
+	}
+	initial_state.belphe_possible = belphe_possible;
+	initial_state.depth = 0;
+	initial_state.parent = NO_PARENT;
+	initial_state.action = 0;
+	const uint64_t initial_hash = search.update_hand_hash(state.hand, belphe_possible);
+
+	std::deque<int32_t> actions;
+	const auto publish = [&] {
+		std::deque<std::string> line;
+		for (const auto action : actions)
+		{
+			line.push_back(action == ACTION_BELPHEGOR ? belphegor::BELPHEGOR_PRIME_STR : std::to_string(action));
+		}
+		stats.win = true;
+		publish_plan(state, search, belphe_possible, length, prev, line, deadline);
+	};
+
+	std::vector<int32_t> root_children;
+	int first_depth = 1;
+	if (length > 0)
+	{
+		if (length <= 10)
+		{
+			for (const auto p : mersenne_check(length, prev.get_si(), state.hand))
+			{
+				root_children.push_back(static_cast<int32_t>(p));
+			}
+		}
+		if (root_children.empty())
+		{
+			if (!belphe_possible)
+			{
+				return;
+			}
+			root_children.push_back(ACTION_BELPHEGOR);
+		}
+	}
+	else
+	{
+		if (is_dead(initial_state))
+		{
+			stats.exhausted = true;
+			return;
+		}
+		// 前の手番までに分かっていることは探索しない
+		if (const auto entry = table.probe(initial_hash))
+		{
+			if (entry->flag == TranspositionTable::WIN && follow_table(table, initial_state, initial_hash, actions))
+			{
+				DBG("table hit: win");
+				publish();
+				return;
+			}
+			if (entry->flag == TranspositionTable::NO_WIN)
+			{
+				DBG("table hit: no win");
+				stats.exhausted = true;
+				return;
+			}
+			if (entry->flag == TranspositionTable::BOUND)
+			{
+				first_depth = entry->bound + 1;
+			}
+		}
+	}
+
+	if (g_beam_width > 0)
+	{
+		if (!search.beam)
+		{
+			search.beam.reset(new BeamStackSearch(g_beam_width));
+		}
+		std::deque<uint64_t> path;
+		const auto result = search.beam->run(initial_state, initial_hash, root_children, length == 0, table, deadline, actions, path);
+		stats.nodes = search.beam->nodes();
+		if (result != ParallelSearch::result_t::FOUND)
+		{
+			stats.exhausted = result == ParallelSearch::result_t::EXHAUSTED;
+			return;
+		}
+		stats.depth = static_cast<int>(actions.size());
+		for (size_t i = 0; i < path.size(); ++i)
+		{
+			if (i > 0 || length == 0)
+			{
+				table.store(path[i], TranspositionTable::WIN, actions[i]);
+			}
+		}
+		publish();
+		return;
+	}
+
+	if (!search.searcher)
+	{
+		search.searcher.reset(new ParallelSearch(g_search_threads > 0 ? g_search_threads : std::thread::hardware_concurrency(), table));
+	}
+	ParallelSearch& searcher = *search.searcher;
+
+	// 反復深化: 深さ制限を 1 手ずつ伸ばし、打ち切られずに探索し尽くしたら勝ちなし
+	// 1 手ごとに少なくとも 1 枚は減るので、残り枚数 + ベルフェの分より深くはならない
+	using result_t = ParallelSearch::result_t;
+	const int max_depth = initial_state.remain + 1 + (length > 0);
+	result_t result = result_t::CUTOFF;
+	uint32_t root = NO_PARENT;
+	int depth = first_depth;
+	for (; depth <= max_depth; ++depth)
+	{
+		stats.depth = depth;
+		result = searcher.run(initial_state, initial_hash, root_children, length == 0, depth, deadline, root);
+		stats.nodes += searcher.nodes();
+		if (result != result_t::CUTOFF)
+		{
+			break;
+		}
+		if (deadline.expired())
+		{
+			result = result_t::TIMEOUT;
+			break;
+		}
+	}
+
+	if (result != result_t::FOUND)
+	{
+		// 探索し尽くしたなら展開した状態はすべて勝ちなし、そうでなければ勝ちがないと分かった深さを覚えておく
+		if (result == result_t::EXHAUSTED)
+		{
+			stats.exhausted = true;
+			searcher.for_each_visited([&table](const uint64_t hash) {
+				table.store(hash, TranspositionTable::NO_WIN);
+			});
+		}
+		else if (length == 0 && depth > first_depth)
+		{
+			table.store(initial_hash, TranspositionTable::BOUND, 0, depth - 1);
+		}
+		return;
+	}
+
+	// 勝ちを見つけたノードから根までたどって勝ち筋を作り直す
+	actions = searcher.solution_chain();
+	for (uint32_t ans = searcher.solution(); searcher.node(ans).parent != NO_PARENT; ans = searcher.node(ans).parent)
+	{
+		const uint32_t parent = searcher.node(ans).parent;
+		actions.push_front(searcher.node(ans).action);
+		if (parent != root || length == 0)
+		{
+			table.store(searcher.hash(parent), TranspositionTable::WIN, searcher.node(ans).action);
+		}
+	}
+	publish();
+}
+
+/**
+ * 先読み
+ *
+ * 自分の手を返してから次のメッセージが来るまで (相手が考えている間) に、次の手番で見込まれる場の桁数ごとに出す素数を探しておく
+ * 乱数は手番ごとに (seed, stream, 手番の番号) から作り直すので、手番の番号と手札が見込みどおりなら、先読みした手は先読みしなかったときの手と同じになる
+ * ただし先読みにかかった時間が手番の残り時間を超えるものは使わない (先読みしなければ打ち切られて別の手になりうる)。同じ速さで探索できるとみなす
+ * 相手の時計も壁時計で測られるので、先読みは SCHED_IDLE で 1 スレッドだけ、次の手番の持ち時間までしか回さない
+ */
+namespace ponder
+{
+/**
+ * 自分の次の手番の場の桁数を見込む
+ *
+ * length は自分の手番の後の場の桁数
+ * 場の桁数は出るたびに倍になる。set_action_rewords と同じく、手札が場の桁数以上ある相手は出し、足りない相手はパスするとみなす
+ * 見込みの高い順 (全員が出せるだけ出したときの桁数から、途中でパスが出たときの桁数へ) に返す
+ * 空なら誰も出せず、次は自分が親になる見込み
+ */
+static std::vector<int> forecast(const std::vector<std::pair<std::string, card_type>>& hands, const std::string& name, const int length)
+{
+	std::vector<int> lengths;
+	const size_t n = hands.size();
+	size_t me = 0;
+	for (; me < n && hands[me].first != name; ++me);
+	if (me == n || length <= 0)
+	{
+		return lengths;
+	}
+	int l = length;
+	for (size_t i = 1; i < n; ++i)
+	{
+		if (hands[(me + i) % n].second >= l)
+		{
+			l *= 2;
+			lengths.push_back(l);
+		}
+	}
+	std::reverse(lengths.begin(), lengths.end());
+	return lengths;
+}
+
+/**
+ * 先読みで見つけておいた手
+ *
+ * 手番の番号と手札 (ベルフェの分を除く前) が先読みしたときと同じなら使う
+ * 別の手札で見つけた素数は、今の手札で作れても使わない (先読みしないときに出す手と変わってしまう)
+ * 手札は手番ごとに必ず変わる (出すか引く) ので、次の先読みを始めたら捨てる
+ */
+class Inventory
+{
+public:
+	void reset(const uint64_t turn, const card_type * const hand)
+	{
+		this->turn = turn;
+		std::memcpy(key, hand, sizeof(key));
+		items.clear();
+	}
+
+	void clear()
+	{
+		items.clear();
+	}
+
+	/**
+	 * 場の桁数 length で出す手 (play の cards、空ならパス)
+	 *
+	 * 先読みしていないか、探すのに budget 秒より長くかかっていたら nullptr
+	 */
+	const std::string* find(const uint64_t turn, const card_type * const hand, const int length, const double budget) const
+	{
+		if (turn != this->turn || !std::equal(hand, hand + 10, key))
+		{
+			return nullptr;
+		}
+		for (const auto& item : items)
+		{
+			if (item.length == length)
+			{
+				return item.seconds <= budget ? &item.ans : nullptr;
+			}
+		}
+		return nullptr;
+	}
+
+	void add(const int length, const char* const ans, const double seconds)
+	{
+		items.push_back(item_t{length, ans ? ans : "", seconds});
+	}
+
+private:
+	struct item_t
+	{
+		int length;
+		std::string ans;
+		double seconds;     //!< 探すのにかかった秒数
+	};
+	uint64_t turn = 0;
+	hand_type key = {0};
+	std::vector<item_t> items;
+};
+
+class Ponderer
+{
+public:
+	explicit Ponderer(const unsigned stream)
+			: work(0, stream)
+			, stream(stream)
+			, cancel(false)
+	{
+	}
+
+	~Ponderer()
+	{
+		stop();
+	}
+
+	/**
+	 * 先読みを始める
+	 *
+	 * state は今の手番の後の状態、seed は手番の番号 turn の乱数の種、hand は次の手番の手札の見込み
+	 * lengths は forecast で見込んだ場の桁数、budget は先読みに使ってよい秒数
+	 */
+	void start(const solver_state_t& state, const uint64_t seed, const uint64_t turn, const card_type * const hand, const std::vector<int>& lengths, const double budget)
+	{
+		stop();
+		work = state;
+		std::memcpy(work.hand, hand, sizeof(work.hand));
+		work.num_hand = 0;
+		for (int i = 0; i < 10; ++i)
+		{
+			work.num_hand += hand[i];
+		}
+		inventory.reset(turn, hand);
+		cancel.store(false, std::memory_order_relaxed);
+		const deadline_t deadline{clock_type::now() + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(budget)), &cancel};
+		thread = std::thread([this, seed, lengths, deadline] { run(seed, lengths, deadline); });
+	}
+
+	//! 先読みを打ち切って、止まるまで待つ
+	void stop()
+	{
+		if (thread.joinable())
+		{
+			cancel.store(true, std::memory_order_relaxed);
+			thread.join();
+		}
+	}
+
+	//! 先読みを止めて、結果を捨てる (評価の重みや対戦が変わったとき)
+	void invalidate()
+	{
+		stop();
+		inventory.clear();
+	}
+
+	//! stop してから呼ぶ。budget は手番の残り秒数
+	const std::string* find(const uint64_t turn, const card_type * const hand, const int length, const double budget) const
+	{
+		return inventory.find(turn, hand, length, budget);
+	}
+
+private:
+	void run(const uint64_t seed, const std::vector<int>& lengths, const deadline_t& deadline)
+	{
+#ifdef __linux__
+		// 空いている CPU だけを使う
+		const sched_param param{};
+		pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+		if (belphe_check(work))
+		{
+			preserve_belphe(work);
+		}
+
+		// 見込みの高い桁数から、手番の始めと同じ乱数で Solver::play と同じ手を作る
+		for (const int l : lengths)
+		{
+			if (l > work.num_hand)
+			{
+				continue;
+			}
+			work.engine.seed(seed, stream);
+			work.ans_ptr = nullptr;
+			const auto start = clock_type::now();
+			solver2(work, l, deadline);
+			// 打ち切られたら途中の結果は残さない
+			if (deadline.expired())
+			{
+				return;
+			}
+			inventory.add(l, work.ans_ptr, std::chrono::duration<double>(clock_type::now() - start).count());
+		}
+	}
+
+	solver_state_t work;        //!< 先読み用の手札と乱数
+	unsigned stream;
+	Inventory inventory;        //!< 先読みの間は先読みのスレッドだけが触る
+	std::atomic<bool> cancel;
+	std::thread thread;
+};
+}
+
+/**
+ * 制御プログラムとのやりとり
+ *
+ * 1 行 1 メッセージの JSON から必要なものだけ取り出す
+ * play の record は手番ごとに長くなる一方なので、record_from 件目より前は数えるだけで読み飛ばす
+ * record_from が SKIP_RECORD なら record 全体を読み飛ばす
+ */
+namespace protocol
+{
+constexpr size_t SKIP_RECORD = std::numeric_limits<size_t>::max();
+
+//! record の 1 件 (名前, 状態, 手札の枚数, 場の数)
+struct record_t
+{
+	std::string name;
+	std::string status;
+	int count;
+	std::vector<std::string> numbers;
+};
+
+struct message_t
+{
+	std::string action;
+	std::string name;
+	ALIGNED hand_type hand;                                      //!< 手札の枚数分布
+	int num_hand;
+	std::vector<std::string> numbers;                           //!< 場の数 (先頭 num_numbers 個、残りは領域の使い回し)
+	size_t num_numbers;
+	std::vector<std::pair<std::string, card_type>> hands;       //!< 各プレイヤーの手札の枚数
+	std::vector<std::string> names;
+	int uid;
+	double time;
+	std::vector<int> draw;
+	bool binary;                                                //!< init で二進形式を求められた
+	std::vector<record_t> record;                               //!< record_from 件目以降
+	size_t record_size;                                         //!< record の件数 (読み飛ばした分も含む)
+	std::string param;                                          //!< config で受けた評価の重み (JSON)
+
+	message_t()
+	{
+		clear();
+	}
+
+	//! 確保した領域は次のメッセージで使い回す
+	void clear()
+	{
+		action.clear();
+		name.clear();
+		std::memset(hand, 0, sizeof(hand));
+		num_hand = 0;
+		num_numbers = 0;
+		hands.clear();
+		names.clear();
+		uid = 0;
+		time = 0.0;
+		draw.clear();
+		binary = false;
+		record.clear();
+		record_size = 0;
+		param.clear();
+	}
+	//! 場の数を 1 つ足し、書き込み先を返す
+	std::string& push_number()
+	{
+		if (num_numbers == numbers.size())
+		{
+			numbers.emplace_back();
+		}
+		return numbers[num_numbers++];
+	}
+};
+
+// 標準入出力でのやりとり (メッセージの読み書き) は実行ファイルだけが使う
+#ifndef ARUKUKA_LIBRARY
+class MessageReader : public nlohmann::json_sax<nlohmann::json>
+{
+public:
+	MessageReader(message_t& msg, const size_t record_from)
+			: msg(msg)
+			, record_from(record_from) {}
+
+	bool null() override
+	{
+		return true;
+	}
+	bool boolean(bool val) override
+	{
+		if (skip == 0 && depth == 1 && field == BINARY)
+		{
+			msg.binary = val;
+		}
+		return true;
+	}
+	bool number_integer(number_integer_t val) override
+	{
+		return integer(static_cast<int64_t>(val));
+	}
+	bool number_unsigned(number_unsigned_t val) override
+	{
+		return integer(static_cast<int64_t>(val));
+	}
+	bool number_float(number_float_t val, const string_t&) override
+	{
+		if (skip == 0 && depth == 1 && field == TIME)
+		{
+			msg.time = val;
+		}
+		return true;
+	}
+	bool string(string_t& val) override
+	{
+		if (skip)
+		{
+			return true;
+		}
+		if (depth == 1)
+		{
+			if (field == ACTION)
+			{
+				msg.action.swap(val);
+			}
+			else if (field == NAME)
+			{
+				msg.name.swap(val);
+			}
+		}
+		else if (depth == 2)
+		{
+			if (field == NUMBERS)
+			{
+				msg.push_number().assign(val);
+			}
+			else if (field == NAMES)
+			{
+				msg.names.emplace_back(std::move(val));
+			}
+		}
+		else if (depth == 3)
+		{
+			if (field == HANDS)
+			{
+				msg.hands.emplace_back(std::move(val), 0);
+			}
+			else if (field == RECORD)
+			{
+				auto& r = msg.record.back();
+				(r.name.empty() ? r.name : r.status) = std::move(val);
+			}
+		}
+		else if (depth == 4 && field == RECORD)
+		{
+			msg.record.back().numbers.emplace_back(std::move(val));
+		}
+		return true;
+	}
+	bool start_object(std::size_t) override
+	{
+		return enter();
+	}
+	bool key(string_t& val) override
+	{
+		if (skip == 0 && depth == 1)
+		{
+			field = val == "action" ? ACTION
+				: val == "name" ? NAME
+				: val == "hand" ? HAND
+				: val == "numbers" ? NUMBERS
+				: val == "hands" ? HANDS
+				: val == "names" ? NAMES
+				: val == "uid" ? UID
+				: val == "time" ? TIME
+				: val == "draw" ? DRAW
+				: val == "record" ? RECORD
+				: val == "binary" ? BINARY
+				: OTHER;
+		}
+		return true;
+	}
+	bool end_object() override
+	{
+		return leave();
+	}
+	bool start_array(std::size_t) override
+	{
+		if (skip == 0 && depth == 1 && field == RECORD && record_from == SKIP_RECORD)
+		{
+			skip = depth + 1;
+		}
+		if (skip == 0 && depth == 2 && field == RECORD)
+		{
+			if (msg.record_size++ < record_from)
+			{
+				skip = depth + 1;
+			}
+			else
+			{
+				msg.record.emplace_back();
+				msg.record.back().count = 0;
+			}
+		}
+		return enter();
+	}
+	bool end_array() override
+	{
+		return leave();
+	}
+	bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) override
+	{
+		return false;
+	}
+
+private:
+	enum field_t
+	{
+		OTHER,
+		ACTION,
+		NAME,
+		HAND,
+		NUMBERS,
+		HANDS,
+		NAMES,
+		UID,
+		TIME,
+		DRAW,
+		RECORD,
+		BINARY,
+	};
+
+	bool enter()
+	{
+		++depth;
+		return true;
+	}
+	bool leave()
+	{
+		if (skip == depth)
+		{
+			skip = 0;
+		}
+		--depth;
+		return true;
+	}
+	bool integer(const int64_t val)
+	{
+		if (skip)
+		{
+			return true;
+		}
+		if (depth == 1)
+		{
+			if (field == UID)
+			{
+				msg.uid = static_cast<int>(val);
+			}
+			else if (field == TIME)
+			{
+				msg.time = static_cast<double>(val);
+			}
+		}
+		else if (depth == 2)
+		{
+			if (field == HAND && 0 <= val && val < 10)
+			{
+				++msg.hand[val];
+				++msg.num_hand;
+			}
+			else if (field == DRAW)
+			{
+				msg.draw.push_back(static_cast<int>(val));
+			}
+		}
+		else if (depth == 3)
+		{
+			if (field == HANDS && msg.hands.size())
+			{
+				msg.hands.back().second = static_cast<card_type>(val);
+			}
+			else if (field == RECORD)
+			{
+				msg.record.back().count = static_cast<int>(val);
+			}
+		}
+		return true;
+	}
+
+	message_t& msg;
+	const size_t record_from;
+	int depth = 0;
+	int skip = 0;           //!< 読み飛ばしている配列の深さ (0 なら読んでいる)
+	field_t field = OTHER;
+};
+
+/**
+ * 制御プログラムが送ってくる形に決め打ちした読み取り
+ *
+ * 値を作らずに行を 1 回なめて msg に書き込む。エスケープを含む文字列など想定外の形なら false を返すので、
+ * そのときは MessageReader で読み直す
+ */
+class Scanner
+{
+public:
+	Scanner(const std::string& line, message_t& msg, const size_t record_from)
+			: p(line.c_str())
+			, end(line.c_str() + line.size())
+			, msg(msg)
+			, record_from(record_from) {}
+
+	bool message()
+	{
+		if (!consume('{'))
+		{
+			return false;
+		}
+		if (consume('}'))
+		{
+			return finish();
+		}
+		do
+		{
+			const char* key;
+			size_t len;
+			if (!string(key, len) || !consume(':') || !field(key, len))
+			{
+				return false;
+			}
+		} while (consume(','));
+		return consume('}') && finish();
+	}
+
+private:
+	bool finish()
+	{
+		skip_ws();
+		return p == end;
+	}
+	void skip_ws()
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+		{
+			++p;
+		}
+	}
+	bool consume(const char c)
+	{
+		skip_ws();
+		if (p < end && *p == c)
+		{
+			++p;
+			return true;
+		}
+		return false;
+	}
+	static bool equals(const char* s, const size_t len, const char* literal)
+	{
+		return std::strlen(literal) == len && std::memcmp(s, literal, len) == 0;
+	}
+
+	//! エスケープのない文字列の中身を [s, s + len) で返す
+	bool string(const char*& s, size_t& len)
+	{
+		if (!consume('"'))
+		{
+			return false;
+		}
+		s = p;
+		while (p < end && *p != '"')
+		{
+			if (*p == '\\')
+			{
+				return false;
+			}
+			++p;
+		}
+		if (p == end)
+		{
+			return false;
+		}
+		len = p - s;
+		++p;
+		return true;
+	}
+	bool string(std::string& out)
+	{
+		const char* s;
+		size_t len;
+		if (!string(s, len))
+		{
+			return false;
+		}
+		out.assign(s, len);
+		return true;
+	}
+	bool integer(int64_t& out)
+	{
+		skip_ws();
+		const bool negative = p < end && *p == '-';
+		if (negative)
+		{
+			++p;
+		}
+		if (p == end || *p < '0' || '9' < *p)
+		{
+			return false;
+		}
+		out = 0;
+		while (p < end && '0' <= *p && *p <= '9')
+		{
+			out = out * 10 + (*p++ - '0');
+		}
+		if (negative)
+		{
+			out = -out;
+		}
+		return p == end || (*p != '.' && *p != 'e' && *p != 'E');
+	}
+	bool boolean(bool& out)
+	{
+		skip_ws();
+		if (end - p >= 4 && std::memcmp(p, "true", 4) == 0)
+		{
+			out = true;
+			p += 4;
+			return true;
+		}
+		if (end - p >= 5 && std::memcmp(p, "false", 5) == 0)
+		{
+			out = false;
+			p += 5;
+			return true;
+		}
+		return false;
+	}
+	bool real(double& out)
+	{
+		skip_ws();
+		char* next;
+		out = std::strtod(p, &next);
+		if (next == p || next > end)
+		{
+			return false;
+		}
+		p = next;
+		return true;
+	}
+
+	//! [ f(), f(), ... ]
+	template <typename F>
+	bool array(F f)
+	{
+		if (!consume('['))
+		{
+			return false;
+		}
+		if (consume(']'))
+		{
+			return true;
+		}
+		do
+		{
+			if (!f())
+			{
+				return false;
+			}
+		} while (consume(','));
+		return consume(']');
+	}
+
+	//! 入れ子の括弧と文字列だけを見て値 1 つを読み飛ばす
+	bool skip_value()
+	{
+		skip_ws();
+		int depth = 0;
+		while (p < end)
+		{
+			const char c = *p;
+			if (c == '"')
+			{
+				const char* s;
+				size_t len;
+				if (!string(s, len))
+				{
+					return false;
+				}
+			}
+			else if (depth == 0 && (c == ',' || c == '}' || c == ']'))
+			{
+				// 数などの終わり
+				return true;
+			}
+			else
+			{
+				depth += (c == '[' || c == '{') - (c == ']' || c == '}');
+				++p;
+			}
+			if (depth == 0 && (c == '"' || c == ']' || c == '}'))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool field(const char* key, const size_t len)
+	{
+		int64_t x;
+		if (equals(key, len, "action"))
+		{
+			return string(msg.action);
+		}
+		if (equals(key, len, "name"))
+		{
+			return string(msg.name);
+		}
+		if (equals(key, len, "hand"))
+		{
+			return array([this, &x] {
+				if (!integer(x) || x < 0 || 10 <= x)
+				{
+					return false;
+				}
+				++msg.hand[x];
+				++msg.num_hand;
+				return true;
+			});
+		}
+		if (equals(key, len, "numbers"))
+		{
+			return array([this] {
+				return string(msg.push_number());
+			});
+		}
+		if (equals(key, len, "hands"))
+		{
+			return array([this, &x] {
+				msg.hands.emplace_back();
+				auto& h = msg.hands.back();
+				if (!consume('[') || !string(h.first) || !consume(',') || !integer(x) || !consume(']'))
+				{
+					return false;
+				}
+				h.second = static_cast<card_type>(x);
+				return true;
+			});
+		}
+		if (equals(key, len, "names"))
+		{
+			return array([this] {
+				msg.names.emplace_back();
+				return string(msg.names.back());
+			});
+		}
+		if (equals(key, len, "uid"))
+		{
+			if (!integer(x))
+			{
+				return false;
+			}
+			msg.uid = static_cast<int>(x);
+			return true;
+		}
+		if (equals(key, len, "time"))
+		{
+			return real(msg.time);
+		}
+		if (equals(key, len, "draw"))
+		{
+			return array([this, &x] {
+				if (!integer(x))
+				{
+					return false;
+				}
+				msg.draw.push_back(static_cast<int>(x));
+				return true;
+			});
+		}
+		if (equals(key, len, "binary"))
+		{
+			return boolean(msg.binary);
+		}
+		if (equals(key, len, "record") && record_from != SKIP_RECORD)
+		{
+			return array([this, &x] {
+				if (msg.record_size++ < record_from)
+				{
+					return skip_value();
+				}
+				msg.record.emplace_back();
+				auto& r = msg.record.back();
+				if (!consume('[') || !string(r.name) || !consume(',') || !string(r.status) || !consume(',') || !integer(x) || !consume(','))
+				{
+					return false;
+				}
+				r.count = static_cast<int>(x);
+				return array([this, &r] {
+					r.numbers.emplace_back();
+					return string(r.numbers.back());
+				}) && consume(']');
+			});
+		}
+		return skip_value();
+	}
+
+	const char* p;
+	const char* const end;
+	message_t& msg;
+	const size_t record_from;
+};
+
+/**
+ * line を msg に読む
+ *
+ * 決め打ちの Scanner で読めなければ MessageReader で読み直す
+ * JSON として壊れていたら false
+ */
+static bool read(const std::string& line, message_t& msg, const size_t record_from = SKIP_RECORD)
+{
+	msg.clear();
+	if (!Scanner(line, msg, record_from).message())
+	{
+		msg.clear();
+		MessageReader reader(msg, record_from);
+		if (!nlohmann::json::sax_parse(line, &reader))
+		{
+			return false;
+		}
+	}
+	// config はまれなので、重みだけ木にして取り出す
+	if (msg.action == "config")
+	{
+		const nlohmann::json obj = nlohmann::json::parse(line, nullptr, false);
+		if (obj.is_object() && obj.count("param"))
+		{
+			msg.param = obj["param"].dump();
+		}
+	}
+	return true;
+}
+#endif
+
+/**
+ * 自前の対戦用の二進形式
+ *
+ * init に "binary": true があれば、その返事の後から両方向ともこの形式にする
+ * フレームは 4 bytes の長さ (種類 1 byte を含む) + 種類 + 中身。整数はすべて little endian
+ * 数は桁数 (u16) + 1 byte に 2 桁ずつ (上位 4 bit が先) で詰める
+ *
+ * - 'I' init     : 持ち時間 (f64), uid (u8), 人数 (u8), 名前 (u8 長さ + 文字) x 人数
+ * - 'P' play     : 手札の枚数分布 (u16 x 10), 手札の枚数 (u16 x 人数), 場の数の個数 (u8) + 数 x 個数, 増えた record
+ * - 'D' pass     : 引いた札 (u8 枚数 + u8 x 枚数), 増えた record
+ * - 'C' config   : 評価の重み (JSON の文字列、残り全部)
+ * - 'N' new_game, 'Q' quit : 中身なし
+ * - record       : 件数 (u16), 1 件は プレイヤー (u8), 状態 (u8, STATUSES の順), 手札の枚数 (u16), 場の最後の数 (なければ 0 桁)
+ *
+ * 返事は play なら 'N' + 出す数 か 'P' (パス)、それ以外は 'A'
+ */
+namespace binary
+{
+static const char* const STATUSES[] = {"OK", "MERSENNE", "BELPHEGOR", "PASSED"};
+
+#ifndef ARUKUKA_LIBRARY
+class Decoder
+{
+public:
+	Decoder(const std::string& frame)
+			: p(reinterpret_cast<const uint8_t*>(frame.data()))
+			, end(p + frame.size()) {}
+
+	bool ok() const
+	{
+		return good;
+	}
+	template <typename T>
+	T get()
+	{
+		T ret = 0;
+		if (end - p < static_cast<ptrdiff_t>(sizeof(T)))
+		{
+			good = false;
+			return ret;
+		}
+		for (size_t i = 0; i < sizeof(T); ++i)
+		{
+			ret |= static_cast<T>(p[i]) << (8 * i);
+		}
+		p += sizeof(T);
+		return ret;
+	}
+	double get_double()
+	{
+		const uint64_t bits = get<uint64_t>();
+		double ret;
+		std::memcpy(&ret, &bits, sizeof(ret));
+		return ret;
+	}
+	void get_bytes(std::string& out, const size_t n)
+	{
+		if (static_cast<size_t>(end - p) < n)
+		{
+			good = false;
+			return;
+		}
+		out.assign(reinterpret_cast<const char*>(p), n);
+		p += n;
+	}
+	//! 詰めた数を 10 進の文字列にする
+	void get_number(std::string& out)
+	{
+		const size_t digits = get<uint16_t>();
+		const size_t bytes = (digits + 1) / 2;
+		out.clear();
+		if (!good || static_cast<size_t>(end - p) < bytes)
+		{
+			good = false;
+			return;
+		}
+		for (size_t i = 0; i < digits; ++i)
+		{
+			const uint8_t b = p[i / 2];
+			out.push_back(static_cast<char>('0' + (i % 2 ? b & 0x0f : b >> 4)));
+		}
+		p += bytes;
+	}
+
+private:
+	const uint8_t* p;
+	const uint8_t* const end;
+	bool good = true;
+};
+
+static void put_number(std::string& out, const char* digits, const size_t n)
+{
+	out.push_back(static_cast<char>(n & 0xff));
+	out.push_back(static_cast<char>(n >> 8));
+	for (size_t i = 0; i < n; i += 2)
+	{
+		const int hi = digits[i] - '0';
+		const int lo = i + 1 < n ? digits[i + 1] - '0' : 0;
+		out.push_back(static_cast<char>(hi << 4 | lo));
+	}
+}
+
+static void read_record(Decoder& in, message_t& msg, const std::vector<std::string>& names, const size_t record_from)
+{
+	const size_t n = in.get<uint16_t>();
+	msg.record_size = record_from + n;
+	for (size_t i = 0; i < n && in.ok(); ++i)
+	{
+		msg.record.emplace_back();
+		auto& r = msg.record.back();
+		const size_t player = in.get<uint8_t>();
+		const size_t status = in.get<uint8_t>();
+		r.name = player < names.size() ? names[player] : std::string();
+		r.status = status < sizeof(STATUSES) / sizeof(STATUSES[0]) ? STATUSES[status] : "ERROR";
+		r.count = in.get<uint16_t>();
+		r.numbers.emplace_back();
+		in.get_number(r.numbers.back());
+		if (r.numbers.back().empty())
+		{
+			r.numbers.pop_back();
+		}
+	}
+}
+
+/**
+ * 1 フレーム読んで msg にする
+ *
+ * names は init で受けた名前 (手札の枚数と record のプレイヤーの並び)、self は自分の名前
+ * 入力が尽きたか壊れていたら false
+ */
+static bool read(std::istream& is, std::string& frame, message_t& msg, const std::vector<std::string>& names, const std::string& self, const size_t record_from)
+{
+	uint8_t header[4];
+	if (!is.read(reinterpret_cast<char*>(header), sizeof(header)))
+	{
+		return false;
+	}
+	const uint32_t size = header[0] | header[1] << 8 | header[2] << 16 | static_cast<uint32_t>(header[3]) << 24;
+	frame.resize(size);
+	if (size == 0 || !is.read(&frame[0], size))
+	{
+		return false;
+	}
+
+	msg.clear();
+	Decoder in(frame);
+	switch (in.get<uint8_t>())
+	{
+		case 'I':
+		{
+			msg.action = "init";
+			msg.binary = true;
+			msg.time = in.get_double();
+			msg.uid = in.get<uint8_t>();
+			const size_t n = in.get<uint8_t>();
+			for (size_t i = 0; i < n && in.ok(); ++i)
+			{
+				msg.names.emplace_back();
+				in.get_bytes(msg.names.back(), in.get<uint8_t>());
+			}
+			break;
+		}
+		case 'P':
+		{
+			msg.action = "play";
+			msg.name = self;
+			for (int i = 0; i < 10; ++i)
+			{
+				msg.hand[i] = static_cast<card_type>(in.get<uint16_t>());
+				msg.num_hand += msg.hand[i];
+			}
+			for (const auto& name : names)
+			{
+				msg.hands.emplace_back(name, static_cast<card_type>(in.get<uint16_t>()));
+			}
+			const size_t n = in.get<uint8_t>();
+			for (size_t i = 0; i < n && in.ok(); ++i)
+			{
+				in.get_number(msg.push_number());
+			}
+			read_record(in, msg, names, record_from);
+			break;
+		}
+		case 'D':
+		{
+			msg.action = "pass";
+			msg.name = self;
+			const size_t n = in.get<uint8_t>();
+			for (size_t i = 0; i < n && in.ok(); ++i)
+			{
+				msg.draw.push_back(in.get<uint8_t>());
+			}
+			read_record(in, msg, names, record_from);
+			break;
+		}
+		case 'C':
+			msg.action = "config";
+			msg.param.assign(frame, 1, std::string::npos);
+			break;
+		case 'N':
+			msg.action = "new_game";
+			break;
+		case 'Q':
+			msg.action = "quit";
+			break;
+		default:
+			return false;
+	}
+	return in.ok();
+}
+
+static void write_frame(std::ostream& os, const std::string& body)
+{
+	const uint32_t size = static_cast<uint32_t>(body.size());
+	const char header[4] = {
+		static_cast<char>(size & 0xff), static_cast<char>(size >> 8 & 0xff),
+		static_cast<char>(size >> 16 & 0xff), static_cast<char>(size >> 24 & 0xff),
+	};
+	os.write(header, sizeof(header));
+	os.write(body.data(), body.size());
+	os.flush();
+}
+#endif
+}
+
+#ifndef ARUKUKA_LIBRARY
+/**
+ * play への返事
+ *
+ * ans は generate_ans の形 ("[d, d, ...]")、nullptr ならパス
+ */
+static void write_play(std::ostream& os, const bool use_binary, const char* ans)
+{
+	if (!use_binary)
+	{
+		if (ans)
+		{
+			os << "{\"action\": \"number\", \"cards\": " << ans << "}";
+		}
+		else
+		{
+			os << "{\"action\": \"pass\"}";
+		}
+		os << std::endl << std::flush;
+		return;
+	}
+	static std::string body, digits;
+	body.assign(1, ans ? 'N' : 'P');
+	if (ans)
+	{
+		digits.clear();
+		for (const char* c = ans; *c; ++c)
+		{
+			if ('0' <= *c && *c <= '9')
+			{
+				digits.push_back(*c);
+			}
+		}
+		binary::put_number(body, digits.data(), digits.size());
+	}
+	binary::write_frame(os, body);
+}
+
+//! play 以外への返事
+static void write_ack(std::ostream& os, const bool use_binary)
+{
+	if (use_binary)
+	{
+		binary::write_frame(os, std::string(1, 'A'));
+	}
+	else
+	{
+		os << std::endl << std::flush;
+	}
+}
+#endif
+}
+
+/**
+ * 対戦の状態
+ *
+ * play の record は前回から増えた分だけ、pass は引いた札だけを読んで更新する
+ * 場の数は最後の 1 つだけを mpz_class にする
+ */
+namespace game
+{
+class GameState
+{
+public:
+	//! init を受けたら対戦をはじめからにする
+	void reset(const protocol::message_t& msg)
+	{
+		names = msg.names;
+		self = msg.uid < static_cast<int>(names.size()) ? names[msg.uid] : std::string();
+		counts.assign(names.size(), -1);
+		hands.clear();
+		for (const auto& name : names)
+		{
+			hands.emplace_back(name, 0);
+		}
+		std::memset(played, 0, sizeof(played));
+		std::memcpy(hand, msg.hand, sizeof(hand));
+		consumed = 0;
+		round_size = 0;
+		round_length = 0;
+		prev_str.clear();
+		prev = 0;
+	}
+
+	//! 次のメッセージで読む record の最初の件
+	size_t record_from() const
+	{
+		return consumed;
+	}
+
+	void play(const protocol::message_t& msg)
+	{
+		consume(msg);
+		std::memcpy(hand, msg.hand, sizeof(hand));
+
+		round_size = msg.num_numbers;
+		round_length = 0;
+		for (size_t i = 0; i < round_size; ++i)
+		{
+			round_length += static_cast<int>(msg.numbers[i].size());
+		}
+		const std::string& last = round_size ? msg.numbers[round_size - 1] : empty;
+		if (last != prev_str)
+		{
+			prev_str = last;
+			if (prev_str.empty())
+			{
+				prev = 0;
+			}
 			else
 			{
-				std::vector<int> cards;
-				cards.reserve(5);
-				for (int i = 0; i < 10; ++i)
+				prev.set_str(prev_str, 10);
+			}
+		}
+
+		// 名前の並びは対戦中変わらないので枚数だけ書き換える
+		if (msg.hands.size() != hands.size())
+		{
+			hands = msg.hands;
+		}
+		for (size_t i = 0; i < hands.size(); ++i)
+		{
+			if (hands[i].first != msg.hands[i].first)
+			{
+				hands[i].first = msg.hands[i].first;
+			}
+			hands[i].second = msg.hands[i].second;
+		}
+	}
+
+	void pass(const protocol::message_t& msg)
+	{
+		consume(msg);
+		for (const int card : msg.draw)
+		{
+			if (0 <= card && card < 10)
+			{
+				++hand[card];
+			}
+		}
+	}
+
+	const std::string& name() const
+	{
+		return self;
+	}
+	const std::vector<std::string>& player_names() const
+	{
+		return names;
+	}
+	//! 場の数の個数
+	size_t size() const
+	{
+		return round_size;
+	}
+	//! 場の桁数 (親なら 0)
+	int length() const
+	{
+		return round_length;
+	}
+	//! 直前の数 (親なら 0)
+	const mpz_class& last() const
+	{
+		return prev;
+	}
+	const std::vector<std::pair<std::string, card_type>>& players() const
+	{
+		return hands;
+	}
+	//! これまでに誰かが出した数字ごとの枚数
+	const int* played_cards() const
+	{
+		return played;
+	}
+	//! 自分の手札 (pass で引いた札を足したもの)
+	const card_type* cards() const
+	{
+		return hand;
+	}
+
+private:
+	/**
+	 * 増えた record を読む
+	 *
+	 * 手札が出した数の桁数だけ減っていたら、その数の札が出たとみなす
+	 */
+	void consume(const protocol::message_t& msg)
+	{
+		for (const auto& r : msg.record)
+		{
+			const size_t i = std::find(names.begin(), names.end(), r.name) - names.begin();
+			if (i == names.size())
+			{
+				continue;
+			}
+			if (counts[i] >= 0 && r.numbers.size() && counts[i] - r.count == static_cast<int>(r.numbers.back().size()))
+			{
+				for (const char c : r.numbers.back())
 				{
-					for (int j = 0; j < node->cur_hand[i]; ++j)
-					{
-						cards.push_back(i);
-					}
+					++played[c - '0'];
 				}
-				std::sort(cards.begin(), cards.end());
-				do
-				{
-					int p = 0;
-					for (const int x : cards)
+			}
+			counts[i] = r.count;
+		}
+		consumed = std::max(consumed, msg.record_size);
+	}
+
+	std::vector<std::string> names;
+	std::string self;
+	std::vector<int> counts;                                    //!< record で最後に見た手札の枚数 (まだなら -1)
+	std::vector<std::pair<std::string, card_type>> hands;
+	ALIGNED int played[10];
+	ALIGNED hand_type hand;
+	size_t consumed = 0;
+	size_t round_size = 0;
+	int round_length = 0;
+	std::string prev_str;
+	mpz_class prev;
+	const std::string empty;
+};
+
+constexpr int NUM_CARDS = 3001;         //!< 山札と全員の手札を合わせた枚数
+constexpr int NUM_DRAW_CARDS = 5;       //!< パスで引く枚数
+constexpr int CARDS_PER_TURN = 5;       //!< 1 手番で出す枚数の見込み
+constexpr int MIN_TURNS = 4;            //!< 残りの手番数の見込みの下限
+constexpr int LONG_ROUND_LENGTH = 32;   //!< 場の桁数がこれを超えたら、超えた割合だけ手番の持ち時間を増やす
+constexpr double MAX_LENGTH_WEIGHT = 4.0;
+
+/**
+ * 対戦全体の持ち時間の配分
+ *
+ * 持ち時間 (init の time) は対戦全体の合計で、審判は init, play, pass の返事までの時間をすべて数える
+ * メッセージを受けてから返事を書くまでを steady_clock で測って足していく
+ * 手番の持ち時間は 残り時間 / 残りの手番数の見込み で、場の桁数が長い (素数判定が重い) ほど多めに配る
+ */
+class TimeManager
+{
+public:
+	void reset(const double limit)
+	{
+		this->limit = limit;
+		used = 0.0;
+	}
+
+	//! start に受けたメッセージの返事を書いた
+	void spend(const clock_type::time_point start)
+	{
+		used += std::chrono::duration<double>(clock_type::now() - start).count();
+	}
+
+	//! 通信の分を除いた残り時間 (秒)
+	double remain() const
+	{
+		return std::max(0.0, limit - used - TIME_MARGIN);
+	}
+
+	/**
+	 * 自分の残りの手番数の見込み
+	 *
+	 * 対戦は誰かの手札が無くなるか山札が尽きたら終わる
+	 * 山札は 1 周で最大 (人数 - 1) 人のパスの分だけ減り、手札は 1 手番で CARDS_PER_TURN 枚ほど減るとみなす
+	 */
+	static int remaining_turns(const GameState& game)
+	{
+		const auto& hands = game.players();
+		int in_hands = 0;
+		int min_hand = std::numeric_limits<int>::max();
+		for (const auto& h : hands)
+		{
+			in_hands += h.second;
+			if (h.second > 0)
+			{
+				min_hand = std::min<int>(min_hand, h.second);
+			}
+		}
+		int played = 0;
+		for (int i = 0; i < 10; ++i)
+		{
+			played += game.played_cards()[i];
+		}
+		const int stock = std::max(0, NUM_CARDS - in_hands - played);
+		const int others = std::max<int>(1, static_cast<int>(hands.size()) - 1);
+		const int by_stock = stock / (NUM_DRAW_CARDS * others) + 1;
+		const int by_hand = min_hand == std::numeric_limits<int>::max() ? by_stock : min_hand / CARDS_PER_TURN + 1;
+		return std::max(MIN_TURNS, std::min(by_stock, by_hand));
+	}
+
+	//! 場が game の手番に使ってよい秒数
+	double turn_budget(const GameState& game) const
+	{
+		const double remain = this->remain();
+		const double weight = std::min(MAX_LENGTH_WEIGHT, std::max(1.0, static_cast<double>(game.length()) / LONG_ROUND_LENGTH));
+		return std::min(remain * MAX_TURN_TIME_RATIO, remain / remaining_turns(game) * weight);
+	}
+
+	//! start に始まった手番の打ち切り時刻
+	deadline_t turn_deadline(const GameState& game, const clock_type::time_point start) const
+	{
+		const double budget = turn_budget(game);
+		DBG(budget);
+		return deadline_t{start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(budget))};
+	}
+
+private:
+	double limit = DEFAULT_TIME_LIMIT;
+	double used = 0.0;
+};
+}
+
+/**
+ * 1 人分の solver
+ *
+ * 手札、乱数、評価の重み、置換表、勝ち筋、対戦の状態をすべてこのオブジェクトが持つ
+ * 1 つのプロセスで複数のプレイヤーや対戦を別々の Solver として並行に動かせる
+ * (同じ Solver を複数のスレッドから同時に呼ぶことはできない)
+ */
+class Solver
+{
+public:
+	/**
+	 * seed と stream で乱数列を決める
+	 *
+	 * 同じ seed から stream を変えて作った Solver どうしは乱数列が重ならない
+	 * 乱数は手番ごとに (seed, stream, 手番の番号) から作り直すので、先読みの有無や探索のスレッド数を変えても乱数列は変わらない
+	 */
+	explicit Solver(const uint64_t seed, const unsigned stream = 0)
+			: state(seed, stream)
+			, stream(stream)
+			, base_seed(seed)
+			, turns(0)
+			, ponderer(stream)
+			, next_hand{0}
+			, pondering(false)
+	{
+		start_game(protocol::message_t());
+	}
+
+	void seed(const uint64_t seed)
+	{
+		ponderer.invalidate();
+		base_seed = seed;
+		turns = 0;
+	}
+
+	//! 評価の重みを JSON (かそのファイル名) で上書きする。壊れていたら false
+	bool set_penalty(const std::string& text)
+	{
+		ponderer.invalidate();
+		return ::set_penalty(state, text);
+	}
+
+	//! init: 持ち時間を受け取って対戦を始める。turn_start はメッセージを受け取った時刻
+	void init(const protocol::message_t& msg, const clock_type::time_point turn_start)
+	{
+		start_game(msg);
+		prime_table::anagram_primes().build(timer.turn_deadline(game, turn_start));
+		timer.spend(turn_start);
+	}
+
+	/**
+	 * 対戦ごとの状態を捨てる
+	 *
+	 * 素数表や置換表、終盤のメモは対戦によらないので残す
+	 */
+	void start_game(const protocol::message_t& msg)
+	{
+		ponderer.invalidate();
+		pondering = false;
+		timer.reset(msg.time > 0.0 ? msg.time : DEFAULT_TIME_LIMIT);
+		search.plan.clear();
+		search.move.clear();
+		game.reset(msg);
+	}
+
+	/**
+	 * 手番の手を決める
+	 *
+	 * turn_start はメッセージを受け取った時刻。返り値は play の返事の cards で、nullptr ならパス
+	 * 次の play まで有効
+	 */
+	const char* play(const protocol::message_t& msg, const clock_type::time_point turn_start)
+	{
+		ponderer.stop();
+		const auto& name = msg.name;
+
+		std::memcpy(state.hand, msg.hand, sizeof(state.hand));
+		state.num_hand = msg.num_hand;
+		state.engine.seed(util::Xoshiro256::derive(base_seed, turns), stream);
+
+		game.play(msg);
+		const auto& hands = game.players();
+
+		set_action_rewords(state, hands, name);
+		threat::observe(search.view, state.hand, game.played_cards(), hands, name);
+
+		const int length = game.length();
+
+		const deadline_t deadline = timer.turn_deadline(game, turn_start);
+
+		// 7 枚の表が init で作り終わらなかったら、持ち時間の 1/4 まで続きを作る
+		prime_table::anagram_primes().build(deadline_t{turn_start + (deadline.limit - turn_start) / 4});
+
+		state.ans_ptr = nullptr;
+		const bool belphe_possible = belphe_check(state);
+		if (belphe_possible)
+		{
+			preserve_belphe(state);
+		}
+
+		// 勝ち確定探索には持ち時間の半分まで使う
+		const deadline_t win_deadline{turn_start + (deadline.limit - turn_start) / 2};
+		search_win(state, search, belphe_possible, length, game.last(), win_deadline);
+		if (search.move.size())
+		{
+			generate_ans(state, search.move);
+		}
+		else
+		{
+			switch (game.size())
+			{
+				case 0:
+					solver0(state, deadline);
+					break;
+				case 1:
+					solver1(state, static_cast<int>(game.last().get_ui()), length, deadline);
+					break;
+				default:
+					const double left = std::chrono::duration<double>(deadline.limit - clock_type::now()).count();
+					if (const auto ans = ponderer.find(turns, msg.hand, length, left))
 					{
-						if (x < 0)
-						{
-							continue;
-						}
-						p *= 10;
-						p += x;
+						DBG("ponder hit");
+						std::memcpy(state.ans_arr, ans->c_str(), ans->size() + 1);
+						state.ans_ptr = ans->empty() ? nullptr : state.ans_arr;
 					}
-					if (is_prime(p))
+					else
 					{
-						tree.insert(node->next(p, node));
+						solver2(state, length, deadline);
 					}
-				} while (std::next_permutation(cards.begin(), cards.end()));
+			}
+			if (!state.ans_ptr && belphe_possible)
+			{
+				state.ans_ptr = belphegor::BELPHEGOR_PRIME_CSTR;
+			}
+		}
+
+		// 出した後の手札と場の桁数から次の手番を見込む (パスなら pass で引いた札が分かってから)
+		// メルセンヌ素数やベルフェで流したら次は自分が親なので見込まない
+		pondering = false;
+		if (state.ans_ptr)
+		{
+			std::memcpy(next_hand, msg.hand, sizeof(next_hand));
+			std::string digits;
+			for (const char* p = state.ans_ptr; *p; ++p)
+			{
+				if ('0' <= *p && *p <= '9')
+				{
+					--next_hand[*p - '0'];
+					digits += *p;
+				}
+			}
+			if (!threat::is_mersenne(digits) && digits != belphegor::BELPHEGOR_PRIME_STR)
+			{
+				next_lengths = ponder::forecast(hands, name, length + static_cast<int>(digits.size()));
+				pondering = true;
 			}
 		}
+
+		++turns;
+		timer.spend(turn_start);
+		return state.ans_ptr;
 	}
 
-	while (ans && ans->parent)
+	//! パスして引いた札を受け取る。審判はこの返事までの時間も持ち時間から引く
+	void pass(const protocol::message_t& msg, const clock_type::time_point turn_start)
 	{
-		g_win_root.push_front(ans->prev_action);
-		ans = ans->parent;
+		ponderer.stop();
+		game.pass(msg);
+		std::memcpy(next_hand, game.cards(), sizeof(next_hand));
+		next_lengths = ponder::forecast(game.players(), game.name(), game.length());
+		pondering = true;
+		timer.spend(turn_start);
 	}
-}
 
-int main(int argc, char** argv)
+	/**
+	 * 次のメッセージが来るまで先読みする
+	 *
+	 * play か pass の返事を送ってから呼ぶ。次に Solver を呼んだときに止まる
+	 */
+	void ponder()
+	{
+		if (g_ponder && pondering)
+		{
+			ponderer.start(state, util::Xoshiro256::derive(base_seed, turns), turns, next_hand, next_lengths, timer.turn_budget(game));
+			pondering = false;
+		}
+	}
+
+	const game::GameState& game_state() const
+	{
+		return game;
+	}
+
+private:
+	solver_state_t state;
+	unsigned stream;
+	uint64_t base_seed;             //!< 手番ごとの乱数の元になる種
+	uint64_t turns;                 //!< これまでの play の回数 (手番の番号)
+	search_state_t search;
+	ponder::Ponderer ponderer;
+	ALIGNED hand_type next_hand;    //!< 次の手番の手札の見込み
+	std::vector<int> next_lengths;  //!< 次の手番の場の桁数の見込み
+	bool pondering;                 //!< 次の ponder で先読みする
+	game::GameState game;
+	game::TimeManager timer;
+};
+
+#ifdef ARUKUKA_LIBRARY
+/**
+ * 共有ライブラリ (libarukuka.so) の C の入口
+ *
+ * 宣言は arukuka.h。受けたものを message_t に詰めて Solver を呼ぶので、対戦の進め方は実行ファイルと同じ
+ * C の呼び出し側に例外を投げないよう、失敗は戻り値で返す
+ */
+struct arukuka_solver
 {
-	std::ios::sync_with_stdio(false);
-	std::string s;
+	arukuka_solver(const uint64_t seed, const unsigned stream)
+			: solver(seed, stream) {}
+
+	Solver solver;
+	protocol::message_t msg;
+};
+
+namespace
+{
+void put_record(protocol::message_t& msg, const game::GameState& game, const arukuka_record* const record, const int num_record)
+{
+	const auto& names = game.player_names();
+	const size_t num_statuses = sizeof(protocol::binary::STATUSES) / sizeof(protocol::binary::STATUSES[0]);
+	msg.record_size = game.record_from() + std::max(0, num_record);
+	for (int i = 0; i < num_record; ++i)
+	{
+		const auto& src = record[i];
+		msg.record.emplace_back();
+		auto& r = msg.record.back();
+		r.name = src.player >= 0 && static_cast<size_t>(src.player) < names.size() ? names[src.player] : std::string();
+		r.status = src.status >= 0 && static_cast<size_t>(src.status) < num_statuses ? protocol::binary::STATUSES[src.status] : "ERROR";
+		r.count = src.hand_count;
+		if (src.number && *src.number)
+		{
+			r.numbers.emplace_back(src.number);
+		}
+	}
+}
+}
+
+extern "C" {
 
-	if (argc > 1)
+arukuka_solver* arukuka_create(const unsigned long long seed, const unsigned stream)
+{
+	try
+	{
+		return new arukuka_solver(seed, stream);
+	}
+	catch (...)
 	{
-		int x = std::stoi(argv[1]);
-		engine.seed(x);
+		return nullptr;
 	}
+}
 
-#ifdef OPTIMIZE_PARAM
+void arukuka_destroy(arukuka_solver* const solver)
+{
+	delete solver;
+}
+
+int arukuka_set_param(arukuka_solver* const solver, const char* const json)
+{
+	try
 	{
-		DBG("load param");
-		std::filesystem::path path(argv[0]);
-		path = path.parent_path().parent_path();
-		path /= "param.json";
-		DBG(path);
-		std::ifstream ifs(path);
-		std::string str((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-		DBG(str);
-		const nlohmann::json obj = nlohmann::json::parse(str);
+		return json && solver->solver.set_penalty(json) ? 0 : -1;
+	}
+	catch (...)
+	{
+		return -1;
+	}
+}
 
-		g_penalty.cards_num = obj["cards_num"].get<int>();
-		DBG(g_penalty.cards_num);
-		g_penalty.random = obj["random"].get<int>();
-		DBG(g_penalty.random);
-		std::vector<int> weakness;
-		for (const auto& w : obj["weakness"])
+int arukuka_init(arukuka_solver* const solver, const double time_limit, const int uid, const int num_players, const char* const* const names, const int hand[10])
+{
+	try
+	{
+		const auto turn_start = clock_type::now();
+		auto& msg = solver->msg;
+		msg.clear();
+		msg.action = "init";
+		msg.time = time_limit;
+		msg.uid = uid;
+		for (int i = 0; i < num_players; ++i)
 		{
-			weakness.push_back(w.get<int>());
+			msg.names.emplace_back(names[i]);
 		}
-		if (weakness.size() != 10)
+		for (int i = 0; i < 10; ++i)
 		{
-			DBG("funny!");
-			return -1;
+			msg.hand[i] = static_cast<card_type>(hand[i]);
+			msg.num_hand += hand[i];
 		}
+		solver->solver.init(msg, turn_start);
+		return 0;
+	}
+	catch (...)
+	{
+		return -1;
+	}
+}
+
+int arukuka_play(arukuka_solver* const solver, const arukuka_turn* const turn, char* const cards, const size_t size)
+{
+	try
+	{
+		const auto turn_start = clock_type::now();
+		const auto& game = solver->solver.game_state();
+		auto& msg = solver->msg;
+		msg.clear();
+		msg.action = "play";
+		msg.name = game.name();
 		for (int i = 0; i < 10; ++i)
 		{
-			g_penalty.weakness[i] = weakness[i];
-			DBG(i);
-			DBG(g_penalty.weakness[i]);
+			msg.hand[i] = static_cast<card_type>(turn->hand[i]);
+			msg.num_hand += turn->hand[i];
+		}
+		const auto& names = game.player_names();
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			msg.hands.emplace_back(names[i], static_cast<card_type>(turn->hand_counts[i]));
+		}
+		for (int i = 0; i < turn->num_numbers; ++i)
+		{
+			msg.push_number().assign(turn->numbers[i]);
+		}
+		put_record(msg, game, turn->record, turn->num_record);
+
+		// 返事の cards ("[1,2,3]" など) から数字だけを取り出す
+		const char* ans = solver->solver.play(msg, turn_start);
+		size_t n = 0;
+		for (; ans && *ans; ++ans)
+		{
+			if ('0' <= *ans && *ans <= '9')
+			{
+				if (n + 1 >= size)
+				{
+					return -1;
+				}
+				cards[n++] = *ans;
+			}
+		}
+		if (size > 0)
+		{
+			cards[n] = '\0';
 		}
+		solver->solver.ponder();
+		return static_cast<int>(n);
 	}
-#endif
+	catch (...)
+	{
+		return -1;
+	}
+}
 
+int arukuka_on_pass(arukuka_solver* const solver, const int* const draw, const int num_draw, const arukuka_record* const record, const int num_record)
+{
+	try
+	{
+		const auto turn_start = clock_type::now();
+		const auto& game = solver->solver.game_state();
+		auto& msg = solver->msg;
+		msg.clear();
+		msg.action = "pass";
+		msg.name = game.name();
+		msg.draw.assign(draw, draw + std::max(0, num_draw));
+		put_record(msg, game, record, num_record);
+		solver->solver.pass(msg, turn_start);
+		solver->solver.ponder();
+		return 0;
+	}
+	catch (...)
 	{
-		decltype(g_dice_dist)::param_type param(0, g_penalty.random + 1);
-		g_dice_dist.param(param);
+		return -1;
 	}
+}
 
-	g_win_root.clear();
+}
+#else
+int main(int argc, char** argv)
+{
+	std::ios::sync_with_stdio(false);
+	std::string s;
 
-	for (;;) {
-		getline(std::cin, s);
-		nlohmann::json obj = nlohmann::json::parse(s);
-		auto action = obj["action"];
+	// 引数は 乱数の種 と --param JSON
+	std::random_device rd;
+	Solver solver((uint64_t(rd()) << 32) | rd());
+	const char* param_arg = nullptr;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--param") == 0 && i + 1 < argc)
+		{
+			param_arg = argv[++i];
+		}
+		else
+		{
+			solver.seed(std::stoull(argv[i]));
+		}
+	}
+	if (const char* width = std::getenv("BEAM_WIDTH"))
+	{
+		g_beam_width = std::atoi(width);
+	}
+	if (const char* ponder = std::getenv("PONDER"))
+	{
+		g_ponder = std::atoi(ponder);
+	}
+	// 1 つのプロセスで対戦を続けて受ける (quit で終わらず、入力が尽きるまで読む)
+	bool session = false;
+	if (const char* mode = std::getenv("SESSION_MODE"))
+	{
+		session = std::atoi(mode) != 0;
+	}
 
-		if (action == "play") {
-			const auto name(obj["name"].get<std::string>());
-			auto hand_(obj["hand"]);
-			auto numbers_(obj["numbers"]);
-			// auto record(obj["record"]);
-			const auto hands_(obj["hands"]);
-
-			memset(g_hand, 0, sizeof(g_hand));
-			g_num_hand = hand_.size();
-			for (const auto card : hand_) {
-				++g_hand[card.get<unsigned int>()];
-			}
-
-			std::vector<mpz_class> numbers;
-			std::stringstream number_ss;
-			mpz_class n;
-			for (const auto number : numbers_) {
-				number_ss << number.get<std::string>();
-				n.set_str(number, 10);
-				numbers.push_back(n);
-			}
-
-			std::vector<std::pair<std::string, card_type>> hands;
-			for (const auto& h : hands_) {
-				const auto p = h.get<std::pair<std::string, card_type>>();
-				hands.push_back(p);
-			}
-
-			set_action_rewords(hands, name);
-
-			int length = number_ss.str().length();
-
-			ans_ptr = nullptr;
-			const bool belphe_possible = belphe_check();
-			if (belphe_possible) {
-				preserve_belphe();
-			}
-
-			search_win(belphe_possible, length, numbers.size() ? numbers.back() : 0_mpz);
-			if (g_win_root.size()) {
-				const std::string act = g_win_root.front();
-				g_win_root.pop_front();
-				generate_ans(act);
-			} else {
-				switch (numbers.size()) {
-					case 0:
-						solver0();
-						break;
-					case 1:
-						solver1(static_cast<int>(numbers.back().get_ui()), length);
-						break;
-					default:
-						if (length > 12)
-							solver_massive(length);
-						else
-							solver(length);
-				}
-				if (!ans_ptr && belphe_possible) {
-					ans_ptr = belphegor::BELPHEGOR_PRIME_CSTR;
-				}
-			}
+	// 評価の重みは環境変数 PENALTY_PARAM、次に --param の順に上書きする (どちらも JSON かそのファイル名)
+	if (const char* param = std::getenv("PENALTY_PARAM"))
+	{
+		if (!solver.set_penalty(param))
+		{
+			std::cerr << "invalid PENALTY_PARAM" << std::endl;
+			return -1;
+		}
+	}
+	if (param_arg && !solver.set_penalty(param_arg))
+	{
+		std::cerr << "invalid --param" << std::endl;
+		return -1;
+	}
+
+	protocol::message_t msg;
+	const game::GameState& game = solver.game_state();
 
-			if (ans_ptr) {
-				std::cout << "{\"action\": \"number\", \"cards\": " << ans_ptr << "}";
-			} else {
-				std::cout << "{\"action\": \"pass\"}";
+	bool use_binary = false;
+	for (;;) {
+		if (use_binary) {
+			if (!protocol::binary::read(std::cin, s, msg, game.player_names(), game.name(), game.record_from())) {
+				break;
+			}
+		} else {
+			if (!getline(std::cin, s)) {
+				break;
+			}
+			if (!protocol::read(s, msg, game.record_from())) {
+				DBG("broken message");
+				continue;
 			}
-			std::cout << std::endl << std::flush;
+		}
+		const auto turn_start = clock_type::now();
+		const auto& action = msg.action;
+
+		if (action == "play") {
+			protocol::write_play(std::cout, use_binary, solver.play(msg, turn_start));
+			solver.ponder();
 		} else if (action == "pass") {
-			auto draw(obj["draw"]);
-			std::cout << std::endl << std::flush;
+			solver.pass(msg, turn_start);
+			protocol::write_ack(std::cout, use_binary);
+			solver.ponder();
 		} else if (action == "init") {
-			int uid(obj["uid"]);
-			auto names(obj["names"]);
-			auto name(names[uid]);
-			auto hand(obj["hand"]);
-			TIME_LIMIT = obj["time"];
-			std::cout << std::endl << std::flush;
+			solver.init(msg, turn_start);
+			// 返事は受けた形式で返し、次から二進形式にする
+			protocol::write_ack(std::cout, use_binary);
+			use_binary = msg.binary;
 
+		} else if (action == "config") {
+			// 対戦の合間に評価の重みを差し替える
+			if (!solver.set_penalty(msg.param)) {
+				DBG("invalid config");
+			}
+			protocol::write_ack(std::cout, use_binary);
+		} else if (action == "new_game") {
+			// 続けて対戦する合図: 次の init までに対戦ごとの状態を捨てておく
+			session = true;
+			solver.start_game(msg);
+			protocol::write_ack(std::cout, use_binary);
 		} else if (action == "quit") {
-			std::cout << std::endl << std::flush;
-			break;
+			protocol::write_ack(std::cout, use_binary);
+			if (!session) {
+				break;
+			}
 		}
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,74 @@
+/* akemi's PrimeDaihinmin Solver (C) 2019 Fixstars Corp. */
+/* libarukuka.so の C の入口: g++ -std=c++17 -O3 -fPIC -shared -DARUKUKA_LIBRARY arukuka.cpp -lgmp -pthread -o libarukuka.so */
+
+#ifndef ARUKUKA_H
+#define ARUKUKA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * 1 人分の solver。別々の arukuka_solver は別々のスレッドから同時に呼べる
+ *
+ * play と on_pass から戻った後も、次に呼ばれるまで裏のスレッドで次の手番を先読みする
+ * (-DPONDER=0 でビルドするとしない)。先読みは優先度を下げた 1 スレッドで、
+ * 持ち時間で探索が打ち切られない限り、出す手は先読みしないときと変わらない
+ */
+typedef struct arukuka_solver arukuka_solver;
+
+/* record の 1 件 */
+typedef struct
+{
+	int player;             /* init の names での位置 */
+	int status;             /* 0: OK, 1: MERSENNE, 2: BELPHEGOR, 3: PASSED */
+	int hand_count;         /* その後の手札の枚数 */
+	const char* number;     /* 出した数 (10 進の文字列)。パスなら NULL */
+} arukuka_record;
+
+/* play の手番に見えているもの */
+typedef struct
+{
+	int hand[10];                   /* 手札の枚数分布 */
+	const int* hand_counts;         /* 各プレイヤーの手札の枚数 (names の順) */
+	const char* const* numbers;     /* 場の数 (10 進の文字列、古い順) */
+	int num_numbers;
+	const arukuka_record* record;   /* 前回の play か on_pass から増えた record (古い順) */
+	int num_record;
+} arukuka_turn;
+
+/*
+ * 失敗したら NULL
+ *
+ * 乱数列は seed と stream で決まる。同じ seed で stream を変えれば、乱数列の重ならない solver を何個でも作れる
+ */
+arukuka_solver* arukuka_create(unsigned long long seed, unsigned stream);
+void arukuka_destroy(arukuka_solver* solver);
+
+/* 評価の重みを JSON (かそのファイル名) で上書きする。成功なら 0 */
+int arukuka_set_param(arukuka_solver* solver, const char* json);
+
+/*
+ * 対戦を始める。hand は配られた手札の枚数分布
+ *
+ * time_limit は対戦全体の持ち時間 (秒)。init, play, on_pass にかかった時間を引きながら手番ごとに配る
+ */
+int arukuka_init(arukuka_solver* solver, double time_limit, int uid, int num_players, const char* const* names, const int hand[10]);
+
+/*
+ * 手番の手を決める
+ *
+ * 出す数を cards に 10 進の文字列で書き、桁数を返す。パスなら 0、失敗したら -1
+ */
+int arukuka_play(arukuka_solver* solver, const arukuka_turn* turn, char* cards, size_t size);
+
+/* パスして draw の札を引いた */
+int arukuka_on_pass(arukuka_solver* solver, const int* draw, int num_draw, const arukuka_record* record, int num_record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,8 +7,7 @@ from pathlib import Path
 import json
 import optuna
 import round_robin
-import tempfile
-import shutil
+import shlex
 
 def objective(trial, controller, entries_dir, hash):
     card_num = trial.suggest_int('cards_num', 0, 1000000)
@@ -21,18 +20,14 @@ def objective(trial, controller, entries_dir, hash):
       'weakness': weakness
     }
 
-    with tempfile.TemporaryDirectory() as dname:
-      temp_dir = Path(dname)
-      temp_entries_dir = temp_dir / Path("./entries")
-      shutil.copytree(entries_dir, temp_entries_dir)
-      with open(temp_dir / Path("param.json"), mode='w') as f:
-        f.write(json.dumps(config))
-      results = round_robin.round_robin(controller=controller, padding=4, directory=temp_entries_dir.resolve())
-      # score = results[hash]['score']
-      score = -(results["stock"] + results["max_cuts"] * 3 * 5) + results["max_cuts"] * 0.001
-
-      print("stock = {}, max_cuts = {}, config = {}".format(results["stock"], results["max_cuts"], config))
-      return score
+    # 重みは引数で渡すので、試行ごとに entries を複製しなくてよい
+    args = ' --param ' + shlex.quote(json.dumps(config))
+    results = round_robin.round_robin(controller=controller, padding=4, directory=entries_dir, args=args)
+    # score = results[hash]['score']
+    score = -(results["stock"] + results["max_cuts"] * 3 * 5) + results["max_cuts"] * 0.001
+
+    print("stock = {}, max_cuts = {}, config = {}".format(results["stock"], results["max_cuts"], config))
+    return score
 
 def main():
     parser = ArgumentParser()
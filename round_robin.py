@@ -49,7 +49,7 @@ def parse_result(stdout, stderr, info):
     print(info)
   return ret
 
-def round_robin(directory = Path('./entries'), padding = False, seed = False, controller = Path('./prime_daihinmin.py'), iter = 100):
+def round_robin(directory = Path('./entries'), padding = False, seed = False, controller = Path('./prime_daihinmin.py'), iter = 100, args = ''):
   hash2entry = {hash(e): e for e in directory.iterdir()}
   # pprint(hash2entry)
   entries = list(hash2entry.keys())
@@ -74,7 +74,7 @@ def round_robin(directory = Path('./entries'), padding = False, seed = False, co
       # print("\t[{} / {}] {}".format(index, num_match, tuple([hash2entry[x].name for x in battlers])))
       index = index + 1
       command = ["python", str(controller)] \
-          + list(itertools.chain.from_iterable([[str(i), str(hash2entry[x]) + ' ' + str(seed)] for i, x in zip(range(len(battlers)), battlers)])) \
+          + list(itertools.chain.from_iterable([[str(i), str(hash2entry[x]) + ' ' + str(seed) + args] for i, x in zip(range(len(battlers)), battlers)])) \
           + ["--seed", str(seed), "--show"]
       # print(command, file=sys.stderr)
       process = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE)